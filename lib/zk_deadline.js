@@ -0,0 +1,79 @@
+//
+// Per-request deadlines and cancellation.
+//
+//   var token = new ZK.CancelToken();
+//   zk.with_deadline(200, token).a_get('/app/config', false, function(rc, error, stat, data) {
+//     // rc is ZOPERATIONTIMEOUT after 200 ms, ZCANCELLED after token.cancel()
+//   });
+//
+// with_deadline returns a view of the handle whose single-request methods
+// pass the deadline and the token to the native layer for the next request
+// only. The native timer wheel answers the request when the deadline
+// passes, and the server's late response is then dropped. init({
+// op_timeout: ms }) sets a deadline for every request of the handle.
+//
+// Composite methods (mkdirp, a_set_large, ...) are not part of the view:
+// a deadline for one of their requests would not bound the whole call.
+//
+
+var METHODS = [
+  'a_create', 'a_exists', 'a_get', 'a_get_linearizable', 'a_get_children', 'a_get_children2',
+  'a_set', 'a_delete_', 'a_get_acl', 'a_set_acl', 'a_sync', 'a_multi', 'a_get_into',
+  'aw_exists', 'aw_get', 'aw_get_children', 'aw_get_children2'
+];
+
+var lastToken = 0;
+
+function CancelToken() {
+  this.id = ++lastToken;
+  this.cancelled = false;
+  this.natives = [];      // native handles with requests under this token
+}
+
+CancelToken.prototype.bind = function bind(native) {
+  if(this.natives.indexOf(native) < 0) this.natives.push(native);
+  return this.id;
+};
+
+// Answers every pending request issued with this token with ZCANCELLED,
+// and any later one right away. Returns the number of pending requests.
+CancelToken.prototype.cancel = function cancel() {
+  var self = this, count = 0;
+  self.cancelled = true;
+  self.natives.forEach(function(native) {
+    count += native.cancel(self.id);
+  });
+  self.natives = [];
+  return count;
+};
+
+module.exports = function(ZooKeeper) {
+  ZooKeeper.CancelToken = CancelToken;
+
+  // with_deadline(ms, [token]): ms 0 keeps the handle's op_timeout
+  ZooKeeper.prototype.with_deadline = function with_deadline(ms, token) {
+    var zk = this;
+    var view = Object.create(zk);
+    METHODS.forEach(function(name) {
+      view[name] = function() {
+        if(token && token.cancelled) {
+          var cb = arguments[arguments.length - 1];
+          process.nextTick(function() {
+            cb(ZooKeeper.ZCANCELLED, 'request cancelled');
+          });
+          return ZooKeeper.ZOK;
+        }
+        var native = zk._native;
+        native.set_next_op(ms || 0, token ? token.bind(native) : 0);
+        try {
+          return zk[name].apply(zk, arguments);
+        } finally {
+          // the wrapper may not have sent anything, e.g. a write refused
+          // on a read-only session
+          native.set_next_op(0, 0);
+        }
+      };
+    });
+    return view;
+  };
+};
@@ -0,0 +1,171 @@
+var _ = require('lodash');
+
+//
+// Managed ephemerals: znodes registered with register_ephemeral(path, data,
+// [options,] cb) are remembered together with their data, flags and ACL.
+//
+// When the session expires, the native handle is dead. Instead of emitting
+// 'close', the handle then opens a replacement session with the last init
+// options (like a resumable session whose saved session expired, see
+// zk_session.js). As soon as it is connected, every registered ephemeral
+// is recreated in pipelined a_multi batches of at most batch_ops creates,
+// which costs one round trip for a few hundred registrations. 'expired' is
+// emitted when the old session is gone and 'ephemerals_restored' with
+// { count, failed, renamed, outage } once the znodes are back. outage is
+// the time in ms from the loss of the connection to the recreation.
+//
+// Sequential ephemerals come back under a new name; 'renamed' lists
+// { from, to } for them.
+//
+
+var DEFAULTS = {
+  batch_ops: 500
+};
+
+function EphemeralRegistry(ZooKeeper, zk, options) {
+  this.ZK = ZooKeeper;
+  this.zk = zk;
+  this.options = _.defaults({}, options, DEFAULTS);
+  this.entries = {};          // created path -> { base, data, flags, acl, path }
+  this.lost = false;          // the session holding them has expired
+  this.connected = zk.state == ZooKeeper.ZOO_CONNECTED_STATE;
+  this.disconnectedAt = 0;
+}
+
+EphemeralRegistry.prototype.isEmpty = function isEmpty() {
+  return _.isEmpty(this.entries);
+};
+
+EphemeralRegistry.prototype.create = function create(base, data, options, cb) {
+  var self = this, ZK = self.ZK;
+  var flags = ZK.ZOO_EPHEMERAL | (options.flags || 0);
+  var existing = self.entries[base];
+  if(existing && !(flags & ZK.ZOO_SEQUENCE)) {
+    // registering the same path again updates its data
+    return self.zk.a_set(base, data, -1, function(rc, error) {
+      if(rc === 0) existing.data = data;
+      cb(rc, error, base);
+    });
+  }
+  var done = function(rc, error, path) {
+    if(rc === 0) {
+      self.entries[path] = { base: base, data: data, flags: flags, acl: options.acl, path: path };
+    }
+    cb(rc, error, path);
+  };
+  return options.acl ? self.zk.a_create(base, data, flags, options.acl, done) : self.zk.a_create(base, data, flags, done);
+};
+
+EphemeralRegistry.prototype.remove = function remove(path, cb) {
+  var self = this;
+  delete self.entries[path];
+  return self.zk.a_delete_(path, -1, function(rc, error) {
+    // gone already is what the caller asked for
+    if(rc === self.ZK.ZNONODE) {
+      rc = 0;
+      error = 'ok';
+    }
+    cb(rc, error);
+  });
+};
+
+// Recreates every entry, batch by batch, all batches in flight at once.
+EphemeralRegistry.prototype.restore = function restore() {
+  var self = this, zk = self.zk;
+  var entries = _.values(self.entries);
+  var failed = [], renamed = [];
+  var pending = 0;
+  self.entries = {};
+
+  function recreated(entry, path) {
+    if(path !== entry.path) renamed.push({ from: entry.path, to: path });
+    entry.path = path;
+    self.entries[path] = entry;
+  }
+
+  function done() {
+    if(--pending > 0) return;
+    var now = Date.now();
+    zk.emit('ephemerals_restored', {
+      count: entries.length - failed.length,
+      failed: failed,
+      renamed: renamed,
+      outage: self.disconnectedAt ? now - self.disconnectedAt : 0
+    });
+    self.disconnectedAt = 0;
+  }
+
+  // Slow path for a batch that failed as a whole: one create each, so a
+  // single bad entry (e.g. a deleted parent) does not sink the others.
+  function oneByOne(batch) {
+    batch.forEach(function(entry) {
+      pending++;
+      var cb = function(rc, error, path) {
+        if(rc === 0) {
+          recreated(entry, path);
+        } else {
+          failed.push({ path: entry.path, rc: rc, error: error });
+        }
+        done();
+      };
+      var rc = entry.acl ? zk.a_create(entry.base, entry.data, entry.flags, entry.acl, cb) : zk.a_create(entry.base, entry.data, entry.flags, cb);
+      if(rc !== 0) cb(rc, 'a_create failed to start');
+    });
+  }
+
+  _.chunk(entries, self.options.batch_ops).forEach(function(batch) {
+    pending++;
+    var ops = batch.map(function(entry) {
+      return { op: 'create', path: entry.base, data: entry.data, flags: entry.flags, acl: entry.acl };
+    });
+    var rc = zk.a_multi(ops, function(rc, error, results) {
+      if(rc === 0) {
+        batch.forEach(function(entry, i) { recreated(entry, results[i].path); });
+      } else {
+        oneByOne(batch);
+      }
+      done();
+    });
+    if(rc !== 0) {
+      oneByOne(batch);
+      done();
+    }
+  });
+  if(!pending) {
+    pending = 1;
+    done();
+  }
+};
+
+// Sees every event the native handle emits. Returns false to swallow it.
+// reopening is true when another handler already opens a new session.
+EphemeralRegistry.prototype.event = function event(ev, a1, a2, reopening) {
+  var self = this, zk = self.zk;
+  if(ev === 'connect') {
+    self.connected = true;
+    if(self.lost) {
+      self.lost = false;
+      self.restore();
+    } else {
+      self.disconnectedAt = 0;
+    }
+  } else if(ev === 'connecting') {
+    if(self.connected) self.disconnectedAt = Date.now();
+    self.connected = false;
+  } else if(ev === 'close') {
+    self.connected = false;
+    if(a2 !== self.ZK.ZOO_EXPIRED_SESSION_STATE || self.isEmpty()) return;
+    if(!self.disconnectedAt) self.disconnectedAt = Date.now();
+    self.lost = true;
+    if(zk.logger) zk.logger("managed ephemerals: session expired, opening a new one for " + _.keys(self.entries).length + " ephemerals");
+    zk.emit('expired', { ephemerals: _.keys(self.entries).length });
+    if(!reopening) {
+      process.nextTick(function() {
+        zk._reopen();
+      });
+    }
+    return false;
+  }
+};
+
+module.exports = EphemeralRegistry;
@@ -0,0 +1,165 @@
+var _ = require('lodash');
+
+//
+// Hedged reads over two sessions, preferably on different servers:
+//
+//   var reads = ZK.hedge(zk1, zk2, { percentile: 95 });
+//   reads.a_get('/app/config', function(rc, error, stat, data) { ... });
+//
+// A read goes to the primary session first. If it has not completed after
+// the hedge delay, the same read is sent to the secondary, and whichever
+// answer arrives first is passed on; the other one is dropped. The delay
+// follows the given percentile of the primary's recent read latencies, so
+// only the slowest reads are duplicated.
+//
+//   percentile   latency percentile to hedge after (default 95)
+//   delay        fixed delay in ms instead of a percentile, or the delay
+//                used until enough samples are in (default 10)
+//   min_delay    bounds for the computed delay (default 1 and 1000 ms)
+//   max_delay
+//   window       primary latencies kept for the percentile (default 512)
+//
+// A read that fails with a connection error is retried on the other
+// session right away instead of waiting for the delay. Reads set no
+// watches: a watch would be left behind on whichever session lost.
+//
+
+var DEFAULTS = {
+  percentile: 95,
+  delay: 10,
+  min_delay: 1,
+  max_delay: 1000,
+  window: 512
+};
+
+var MIN_SAMPLES = 32;      // before this, the initial delay is used
+var RECOMPUTE_EVERY = 64;  // samples between percentile updates
+
+function HedgedReader(ZooKeeper, primary, secondary, options) {
+  this.ZK = ZooKeeper;
+  this.primary = primary;
+  this.secondary = secondary;
+  this.options = _.defaults({}, options, DEFAULTS);
+  this.fixed = options && _.isNumber(options.delay) && _.isUndefined(options.percentile);
+  this.delay = this.options.delay;
+  this.samples = [];
+  this.next = 0;          // ring buffer position
+  this.sinceUpdate = 0;
+  this.counters = { reads: 0, hedged: 0, primary_wins: 0, secondary_wins: 0, failovers: 0 };
+}
+
+HedgedReader.prototype.sample = function sample(ms) {
+  var o = this.options;
+  if(this.samples.length < o.window) {
+    this.samples.push(ms);
+  } else {
+    this.samples[this.next] = ms;
+    this.next = (this.next + 1) % o.window;
+  }
+  if(this.fixed || this.samples.length < MIN_SAMPLES || ++this.sinceUpdate < RECOMPUTE_EVERY) return;
+  this.sinceUpdate = 0;
+  var sorted = this.samples.slice().sort(function(a, b) { return a - b; });
+  var at = sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * o.percentile / 100))];
+  this.delay = Math.max(o.min_delay, Math.min(o.max_delay, at));
+};
+
+// errors after which the other session may still answer
+HedgedReader.prototype.retriable = function retriable(rc) {
+  var ZK = this.ZK;
+  return rc === ZK.ZCONNECTIONLOSS || rc === ZK.ZOPERATIONTIMEOUT || rc === ZK.ZSESSIONEXPIRED ||
+    rc === ZK.ZCLOSING || rc === ZK.ZINVALIDSTATE || rc === ZK.ZSESSIONMOVED;
+};
+
+HedgedReader.prototype.usable = function usable(zk) {
+  return zk.state == this.ZK.ZOO_CONNECTED_STATE || zk.state == this.ZK.ZOO_READONLY_STATE;
+};
+
+// Sends read(zk, cb) to the primary and, when it is late or fails, to the
+// secondary; cb gets the first usable answer.
+HedgedReader.prototype.read = function read(send, cb) {
+  var self = this, counters = self.counters;
+  var start = Date.now();
+  var done = false, timer = null, hedged = false, outstanding = 0, lastArgs = null;
+  counters.reads++;
+
+  function finish(args, fromSecondary) {
+    done = true;
+    if(timer) clearTimeout(timer);
+    if(fromSecondary) {
+      counters.secondary_wins++;
+    } else {
+      counters.primary_wins++;
+    }
+    cb.apply(null, args);
+  }
+
+  function hedge() {
+    timer = null;
+    if(done || hedged || !self.usable(self.secondary)) return;
+    hedged = true;
+    counters.hedged++;
+    issue(self.secondary, true);
+  }
+
+  function issue(zk, isSecondary) {
+    outstanding++;
+    var answered = function(rc) {
+      outstanding--;
+      if(!isSecondary) self.sample(Date.now() - start);
+      if(done) return;
+      lastArgs = arguments;
+      if(!self.retriable(rc)) return finish(arguments, isSecondary);
+      if(!isSecondary && !hedged && self.usable(self.secondary)) {
+        counters.failovers++;
+        if(timer) clearTimeout(timer);
+        return hedge();
+      }
+      if(outstanding === 0) finish(lastArgs, isSecondary);
+    };
+    var rc = send(zk, answered);
+    if(rc !== 0) {
+      // not even queued; treat it like a failed request
+      process.nextTick(function() {
+        answered(rc, 'request could not be sent');
+      });
+    }
+  }
+
+  issue(self.primary, false);
+  if(!done) {
+    timer = setTimeout(hedge, self.delay);
+  }
+  return self.ZK.ZOK;
+};
+
+HedgedReader.prototype.a_get = function a_get(path, data_cb) {
+  return this.read(function(zk, cb) { return zk.a_get(path, false, cb); }, data_cb);
+};
+
+HedgedReader.prototype.a_exists = function a_exists(path, stat_cb) {
+  return this.read(function(zk, cb) { return zk.a_exists(path, false, cb); }, stat_cb);
+};
+
+HedgedReader.prototype.a_get_children = function a_get_children(path, child_cb) {
+  return this.read(function(zk, cb) { return zk.a_get_children(path, false, cb); }, child_cb);
+};
+
+HedgedReader.prototype.a_get_children2 = function a_get_children2(path, child2_cb) {
+  return this.read(function(zk, cb) { return zk.a_get_children2(path, false, cb); }, child2_cb);
+};
+
+HedgedReader.prototype.__defineGetter__('stats', function() {
+  var c = this.counters;
+  return _.extend({}, c, {
+    delay: this.delay,
+    hedge_rate: c.reads ? c.hedged / c.reads : 0,
+    secondary_win_rate: c.hedged ? c.secondary_wins / c.hedged : 0
+  });
+});
+
+module.exports = function(ZooKeeper) {
+  ZooKeeper.HedgedReader = HedgedReader;
+  ZooKeeper.hedge = function hedge(primary, secondary, options) {
+    return new HedgedReader(ZooKeeper, primary, secondary, options);
+  };
+};
@@ -0,0 +1,195 @@
+var net = require('net');
+var dns = require('dns');
+var _ = require('lodash');
+
+//
+// Per-handle server selection.
+//
+// The C client connects to the hosts of the connect string in a fixed
+// order, chosen once in zookeeper_init. With init({ host_policy: {...} })
+// that order is computed here and the handle is initialized with
+// host_order_deterministic, so each process picks its own order instead of
+// every client following the same one.
+//
+//   order              'random' (default), 'rtt', 'locality' or 'load'
+//   locality, tags     for 'locality': hosts whose tag equals locality come
+//                      first, e.g. { locality: 'rack-1', tags: { 'zk1:2181': 'rack-1' } }
+//   observers          shorthand for locality 'observer' with these hosts
+//                      tagged, to keep a read-only pool off the voting members
+//   probe_timeout      for 'rtt' and 'load': probe timeout in ms (default 1000)
+//   rebalance_interval ms between checks that the session is on a preferred
+//                      server (default 0, off)
+//
+// 'load' asks every host for its outstanding requests and average latency
+// with the mntr / stat four-letter words (see zk_probe.js) and puts the
+// least loaded first. Hosts that do not answer go last.
+//
+// Rebalancing drops the TCP connection (not the session). The C client then
+// fails over to the next host in its list and restores its watches there.
+// A round keeps hopping, with jitter, until a preferred server is reached or
+// every host has been tried once.
+//
+
+function parseConnect(connect) {
+  var slash = connect.indexOf('/');
+  var chroot = slash >= 0 ? connect.substring(slash) : '';
+  var hosts = (slash >= 0 ? connect.substring(0, slash) : connect).split(',');
+  return {
+    hosts: _.compact(hosts.map(function(h) { return h.trim(); })),
+    chroot: chroot
+  };
+}
+
+function splitHost(host) {
+  var i = host.lastIndexOf(':');
+  return i > 0 ? { host: host.substring(0, i), port: parseInt(host.substring(i + 1), 10) } : { host: host, port: 2181 };
+}
+
+// cb(rtt) with the TCP connect time in ms, or Infinity
+function probeRtt(host, timeout, cb) {
+  var hp = splitHost(host);
+  var start = Date.now(), finished = false;
+  var socket = net.connect(hp.port, hp.host);
+  function finish(rtt) {
+    if(finished) return;
+    finished = true;
+    socket.destroy();
+    cb(rtt);
+  }
+  socket.setTimeout(timeout, function() { finish(Infinity); });
+  socket.on('connect', function() { finish(Date.now() - start); });
+  socket.on('error', function() { finish(Infinity); });
+}
+
+// cb("ip:port") so that hosts can be compared with zk.server
+function resolveHost(host, cb) {
+  var hp = splitHost(host);
+  if(net.isIP(hp.host)) return cb(hp.host + ':' + hp.port);
+  dns.lookup(hp.host, function(err, address) {
+    cb((err ? hp.host : address) + ':' + hp.port);
+  });
+}
+
+function HostPolicy(zk, policy) {
+  this.zk = zk;
+  this.policy = _.defaults({}, policy, { order: 'random', probe_timeout: 1000, rebalance_interval: 0, tags: {} });
+  if(policy.observers) {
+    var tags = this.policy.tags = _.clone(this.policy.tags);
+    policy.observers.forEach(function(host) { tags[host] = 'observer'; });
+    this.policy.order = 'locality';
+    this.policy.locality = 'observer';
+  }
+  this.hosts = [];
+  this.preferred = {};     // "ip:port" -> true
+  this.hops = 0;
+  this.rebalancing = false;
+  this.timer = null;
+}
+
+// Computes the host order; cb(connectString).
+HostPolicy.prototype.order = function order(connect, cb) {
+  var self = this, policy = self.policy;
+  var parsed = parseConnect(connect);
+  var hosts = _.shuffle(parsed.hosts);
+
+  function done(ordered, preferred) {
+    self.hosts = ordered;
+    self.preferred = {};
+    var pending = preferred.length;
+    if(!pending) return finish();
+    preferred.forEach(function(host) {
+      resolveHost(host, function(address) {
+        self.preferred[address] = true;
+        if(--pending === 0) finish();
+      });
+    });
+    function finish() {
+      self.zk.emit('host_order', { hosts: ordered, preferred: _.keys(self.preferred), rtt: self.rtt, load: self.load });
+      cb(ordered.join(',') + parsed.chroot);
+    }
+  }
+
+  if(policy.order === 'locality') {
+    var local = hosts.filter(function(h) { return policy.tags[h] === policy.locality; });
+    return done(local.concat(_.difference(hosts, local)), local);
+  }
+
+  if(policy.order === 'rtt') {
+    var rtt = self.rtt = {}, pending = hosts.length;
+    return hosts.forEach(function(host) {
+      probeRtt(host, policy.probe_timeout, function(ms) {
+        rtt[host] = ms;
+        if(--pending > 0) return;
+        // stable sort keeps the shuffle between hosts with equal rtt
+        var ordered = _.sortBy(hosts, function(h) { return rtt[h]; });
+        var best = rtt[ordered[0]];
+        done(ordered, ordered.filter(function(h) { return isFinite(rtt[h]) && rtt[h] <= 2 * best + 1; }));
+      });
+    });
+  }
+
+  if(policy.order === 'load') {
+    // required here: zk_probe itself builds on this module
+    return require('./zk_probe').probe(hosts.join(','), { commands: ['mntr', 'stat'], timeout: policy.probe_timeout }, function(err, results) {
+      var load = self.load = {};
+      hosts.forEach(function(host) {
+        var r = results[host];
+        load[host] = r && r.ok && r.outstanding !== null ? r.outstanding + (r.latency_avg || 0) : Infinity;
+      });
+      var ordered = _.sortBy(hosts, function(h) { return load[h]; });
+      var best = load[ordered[0]];
+      done(ordered, ordered.filter(function(h) { return isFinite(load[h]) && load[h] <= 2 * best + 1; }));
+    });
+  }
+
+  // every host is as good as any other
+  done(hosts, []);
+};
+
+HostPolicy.prototype.isPreferred = function isPreferred() {
+  var server = this.zk.server;
+  return !server || _.isEmpty(this.preferred) || !!this.preferred[server];
+};
+
+HostPolicy.prototype.rebalance = function rebalance() {
+  var self = this;
+  if(self.rebalancing || self.isPreferred()) return;
+  self.rebalancing = true;
+  self.hops = 0;
+  self.hop();
+};
+
+HostPolicy.prototype.hop = function hop() {
+  var self = this;
+  self.hops++;
+  if(self.zk.logger) self.zk.logger("host_policy: moving session off " + self.zk.server + " (hop " + self.hops + ")");
+  self.zk.emit('rebalance', { server: self.zk.server, hop: self.hops });
+  self.zk.drop_connection();
+};
+
+// Sees every event the native handle emits.
+HostPolicy.prototype.event = function event(ev) {
+  var self = this;
+  if(ev === 'connect' || ev === 'readonly') {
+    if(!self.timer && self.policy.rebalance_interval > 0) {
+      self.timer = setInterval(function() { self.rebalance(); }, self.policy.rebalance_interval);
+      if(self.timer.unref) self.timer.unref();
+    }
+    if(self.rebalancing) {
+      if(self.isPreferred() || self.hops >= self.hosts.length) {
+        self.rebalancing = false;
+      } else {
+        setTimeout(function() { self.hop(); }, Math.floor(Math.random() * 1000));
+      }
+    }
+  } else if(ev === 'close') {
+    if(self.timer) clearInterval(self.timer);
+    self.timer = null;
+    self.rebalancing = false;
+  }
+};
+
+module.exports = HostPolicy;
+module.exports.parseConnect = parseConnect;
+module.exports.splitHost = splitHost;
+module.exports.probeRtt = probeRtt;
@@ -0,0 +1,155 @@
+var _ = require('lodash');
+
+//
+// Batched ID allocation on a counter znode:
+//
+//   var ids = zk.id_allocator('/app/ids', { block: 1000 });
+//   var id = ids.take();    // a number, or null while no block is reserved
+//   ids.next(function(rc, error, id) { ... });
+//
+// The counter znode holds the first unreserved ID as a decimal string. A
+// block is reserved by reading the counter and writing it back, advanced by
+// the block size, with the version just read. This is a compare-and-swap:
+// when two processes race for the same block, one gets ZBADVERSION and
+// tries again after a random backoff. The IDs of a reserved block are
+// handed out locally without any I/O. The next block is reserved in the
+// background once fewer than prefetch * block IDs are left, so take()
+// rarely finds the range empty.
+//
+//   block        IDs reserved per round trip (default 1000)
+//   prefetch     fraction of a block left when the next block is
+//                reserved (default 0.25)
+//   backoff      first delay in ms after a conflict, doubled per retry up
+//   max_backoff  to max_backoff (default 2 and 200)
+//   max_retries  conflicts in a row before a reservation fails (default 20)
+//
+// IDs are unique, and they increase within one process but not across
+// processes. The unused IDs of a block are lost when the process exits.
+// The counter is created at 0 if it does not exist.
+//
+
+var DEFAULTS = {
+  block: 1000,
+  prefetch: 0.25,
+  backoff: 2,
+  max_backoff: 200,
+  max_retries: 20
+};
+
+function IdAllocator(ZooKeeper, zk, path, options) {
+  this.ZK = ZooKeeper;
+  this.zk = zk;
+  this.path = path;
+  this.options = _.defaults({}, options, DEFAULTS);
+  this.ranges = [];         // reserved { start, end }, end exclusive, oldest first
+  this.left = 0;            // IDs left in ranges
+  this.reserving = false;
+  this.waiters = [];        // next() callbacks waiting for a block
+  this.counters = { ids: 0, blocks: 0, conflicts: 0, waits: 0 };
+}
+
+// Returns the next ID, or null if none is reserved yet; a block is then
+// on its way.
+IdAllocator.prototype.take = function take() {
+  var r = this.ranges[0];
+  if(!r) {
+    this.reserve();
+    return null;
+  }
+  var id = r.start++;
+  if(r.start === r.end) this.ranges.shift();
+  this.left--;
+  this.counters.ids++;
+  if(this.left < this.options.block * this.options.prefetch) this.reserve();
+  return id;
+};
+
+// next(cb(rc, error, id)), always asynchronous
+IdAllocator.prototype.next = function next(cb) {
+  var id = this.take();
+  if(id !== null) {
+    return process.nextTick(function() {
+      cb(0, 'ok', id);
+    });
+  }
+  this.counters.waits++;
+  this.waiters.push(cb);
+};
+
+IdAllocator.prototype.reserve = function reserve() {
+  if(this.reserving) return;
+  this.reserving = true;
+  this.attempt(0);
+};
+
+IdAllocator.prototype.attempt = function attempt(retries) {
+  var self = this, ZK = self.ZK, o = self.options;
+  var rc = self.zk.a_get(self.path, { encoding: 'utf8' }, function(rc, error, stat, data) {
+    if(rc === ZK.ZNONODE) return self.createCounter(retries);
+    if(rc !== 0) return self.failed(rc, error);
+    var start = data ? parseInt(data, 10) : 0;
+    if(isNaN(start)) return self.failed(ZK.ZBADARGUMENTS, 'counter ' + self.path + ' does not hold a number');
+    var end = start + o.block;
+    var rc = self.zk.a_set(self.path, String(end), stat.version, function(rc, error) {
+      if(rc === 0) return self.reserved(start, end);
+      if(rc === ZK.ZBADVERSION && retries < o.max_retries) {
+        self.counters.conflicts++;
+        var delay = Math.min(o.max_backoff, o.backoff * Math.pow(2, retries));
+        return setTimeout(function() {
+          self.attempt(retries + 1);
+        }, delay / 2 + Math.random() * delay / 2);
+      }
+      self.failed(rc, error);
+    });
+    if(rc !== 0) self.failed(rc, 'a_set failed to start');
+  });
+  if(rc !== 0) self.failed(rc, 'a_get failed to start');
+};
+
+IdAllocator.prototype.createCounter = function createCounter(retries) {
+  var self = this;
+  var rc = self.zk.a_create(self.path, "0", 0, function(rc, error) {
+    if(rc !== 0 && rc !== self.ZK.ZNODEEXISTS) return self.failed(rc, error);
+    self.attempt(retries);
+  });
+  if(rc !== 0) self.failed(rc, 'a_create failed to start');
+};
+
+IdAllocator.prototype.reserved = function reserved(start, end) {
+  this.reserving = false;
+  this.ranges.push({ start: start, end: end });
+  this.left += end - start;
+  this.counters.blocks++;
+  var waiters = this.waiters;
+  this.waiters = [];
+  while(waiters.length && this.ranges.length) {
+    waiters.shift()(0, 'ok', this.take());
+  }
+  if(waiters.length) {
+    // more waiters than a block holds
+    this.waiters = waiters.concat(this.waiters);
+    this.reserve();
+  }
+};
+
+IdAllocator.prototype.failed = function failed(rc, error) {
+  this.reserving = false;
+  var waiters = this.waiters;
+  this.waiters = [];
+  waiters.forEach(function(cb) {
+    cb(rc, error, null);
+  });
+};
+
+IdAllocator.prototype.__defineGetter__('stats', function() {
+  return _.extend({ left: this.left }, this.counters);
+});
+
+module.exports = function(ZooKeeper) {
+  ZooKeeper.IdAllocator = IdAllocator;
+
+  // id_allocator(path, [options])
+  ZooKeeper.prototype.id_allocator = function id_allocator(path, options) {
+    return new IdAllocator(ZooKeeper, this, path, options);
+  };
+};
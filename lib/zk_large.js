@@ -0,0 +1,326 @@
+var crypto = require('crypto');
+var _ = require('lodash');
+
+//
+// Large values: payloads bigger than the server's jute.maxbuffer are split
+// across numbered child znodes and described by a JSON manifest stored in
+// the value's own znode:
+//
+//   /path                              {"chunked":1,"generation":3,"tag":"3.9f2c01ab","chunks":5,...,"sha1":"..."}
+//   /path/_chunk-3.9f2c01ab-0000000000 bytes [0, chunk_size)
+//   /path/_chunk-3.9f2c01ab-0000000001 bytes [chunk_size, 2 * chunk_size)
+//   ...
+//
+// The tag adds a random token to the generation, so two writers racing
+// from the same manifest never share chunk names. The loser's cleanup can
+// only remove its own chunks. Manifests without a tag name their chunks
+// by the generation alone.
+//
+// Chunks of a new generation are written with pipelined multi transactions.
+// Each multi is kept under batch_bytes so that every request still fits in
+// jute.maxbuffer. The manifest update is a version-checked set in the last
+// multi, which is the commit point. When the whole value fits in one batch,
+// chunks and manifest are written in one atomic transaction. Readers only
+// follow the manifest, so they see either the old or the new generation.
+// Chunks of the replaced generation are removed after the commit.
+//
+
+var CHUNK_PREFIX = '_chunk-';
+var DEFAULTS = {
+  chunk_size: 256 * 1024,
+  batch_bytes: 768 * 1024,
+  read_retries: 3
+};
+
+function chunkPath(path, tag, index) {
+  var n = String(index);
+  while(n.length < 10) n = '0' + n;
+  return path + '/' + CHUNK_PREFIX + tag + '-' + n;
+}
+
+function chunkTag(manifest) {
+  return manifest.tag || manifest.generation;
+}
+
+function sha1(buffer) {
+  return crypto.createHash('sha1').update(buffer).digest('hex');
+}
+
+function parseManifest(data) {
+  if(!data) return null;
+  var m;
+  try {
+    m = JSON.parse(data.toString('utf8'));
+  } catch(e) {
+    return null;
+  }
+  return (m && m.chunked === 1) ? m : null;
+}
+
+function options(zk) {
+  return _.defaults({}, zk.config && zk.config.large_value, DEFAULTS);
+}
+
+// Packs ops into arrays whose payload stays below batch_bytes.
+function batches(ops, batch_bytes) {
+  var out = [], cur = [], bytes = 0;
+  ops.forEach(function(op) {
+    var len = op.data ? op.data.length : 0;
+    if(cur.length && bytes + len > batch_bytes) {
+      out.push(cur);
+      cur = [];
+      bytes = 0;
+    }
+    cur.push(op);
+    bytes += len;
+  });
+  if(cur.length) out.push(cur);
+  return out;
+}
+
+// Runs all batches concurrently; cb(rc, error) with the first failure.
+function multiAll(zk, list, cb) {
+  var pending = list.length, failed = false;
+  if(!pending) return cb(0, 'ok');
+  list.forEach(function(ops) {
+    var rc = zk._native.a_multi(ops, function(rc, error) {
+      done(rc, error);
+    });
+    if(rc !== 0) done(rc, 'a_multi failed to start');
+  });
+  function done(rc, error) {
+    if(failed) return;
+    if(rc !== 0) {
+      failed = true;
+      return cb(rc, error);
+    }
+    if(--pending === 0) cb(0, 'ok');
+  }
+}
+
+// deletes carry no payload, so batches are bounded by count instead
+var DELETE_BATCH = 1000;
+
+function deleteChunks(zk, path, manifest, cb) {
+  multiAll(zk, _.chunk(chunkDeletes(path, manifest), DELETE_BATCH), cb);
+}
+
+function chunkDeletes(path, manifest) {
+  var ops = [];
+  for(var i = 0; i < manifest.chunks; i++) {
+    ops.push({ op: 'delete', path: chunkPath(path, chunkTag(manifest), i), version: -1 });
+  }
+  return ops;
+}
+
+// Individual deletes for cleaning up a partially written generation, where
+// some chunks may not exist and would fail a whole multi.
+function dropChunks(zk, path, tag, chunks, cb) {
+  var pending = chunks;
+  if(!pending) return cb();
+  for(var i = 0; i < chunks; i++) {
+    var rc = zk._native.a_delete_(chunkPath(path, tag, i), -1, done);
+    if(rc !== 0) done();
+  }
+  function done() {
+    if(--pending === 0) cb();
+  }
+}
+
+function readManifest(zk, path, cb) {
+  zk._native.a_get(path, false, function(rc, error, stat, data) {
+    cb(rc, error, stat, data, rc === 0 ? parseManifest(data) : null);
+  });
+}
+
+module.exports = function(ZooKeeper) {
+
+  // a_set_large(path, data, cb(rc, error, stat))
+  // creates the value if it does not exist, otherwise replaces it
+  ZooKeeper.prototype.a_set_large = function a_set_large(path, data, stat_cb) {
+    var self = this;
+    if(this.logger) this.logger("Calling a_set_large on " + path);
+    var opts = options(self);
+    if(!Buffer.isBuffer(data)) data = new Buffer(String(data), 'utf8');
+
+    readManifest(self, path, function(rc, error, stat, old, prev) {
+      if(rc === ZooKeeper.ZNONODE) {
+        // the value's znode must exist before chunks can be created under it
+        // in separate transactions; readers treat a pending manifest as absent
+        var placeholder = JSON.stringify({ chunked: 1, generation: 0, chunks: 0, pending: true });
+        return self._native.a_create(path, placeholder, 0, function(rc, error) {
+          if(rc !== 0 && rc !== ZooKeeper.ZNODEEXISTS) return stat_cb(rc, error, null);
+          self.a_set_large(path, data, stat_cb);
+        });
+      }
+      if(rc !== 0) return stat_cb(rc, error, null);
+      write(prev, stat.version);
+    });
+
+    function write(prev, version) {
+      var generation = (prev ? prev.generation : 0) + 1;
+      var tag = generation + '.' + crypto.randomBytes(4).toString('hex');
+      var chunks = Math.max(1, Math.ceil(data.length / opts.chunk_size));
+      var manifest = JSON.stringify({
+        chunked: 1,
+        generation: generation,
+        tag: tag,
+        chunks: chunks,
+        chunk_size: opts.chunk_size,
+        size: data.length,
+        sha1: sha1(data)
+      });
+
+      var ops = [];
+      for(var i = 0; i < chunks; i++) {
+        ops.push({
+          op: 'create',
+          path: chunkPath(path, tag, i),
+          data: data.slice(i * opts.chunk_size, Math.min(data.length, (i + 1) * opts.chunk_size)),
+          flags: 0
+        });
+      }
+      var commit = { op: 'set', path: path, data: manifest, version: version };
+
+      var list = batches(ops, opts.batch_bytes);
+      var last = list.pop();
+      if(last.reduce(function(n, op) { return n + op.data.length; }, manifest.length) <= opts.batch_bytes) {
+        last.push(commit);
+        finish(list, last);
+      } else {
+        list.push(last);
+        finish(list, [commit]);
+      }
+
+      function finish(body, tail) {
+        multiAll(self, body, function(rc, error) {
+          if(rc !== 0) return abort(rc, error);
+          var rc2 = self._native.a_multi(tail, function(rc, error, results) {
+            if(rc !== 0) return abort(rc, error);
+            var stat = results[results.length - 1].stat;
+            if(prev && prev.chunks) {
+              deleteChunks(self, path, prev, function(rc, error) {
+                if(rc !== 0 && self.logger) self.logger("a_set_large: failed to remove generation " + prev.generation + " of " + path + ": " + error);
+              });
+            }
+            stat_cb(0, 'ok', stat);
+          });
+          if(rc2 !== 0) abort(rc2, 'a_multi failed to start');
+        });
+      }
+
+      function abort(rc, error) {
+        // best effort: drop whatever part of our generation was written
+        dropChunks(self, path, tag, chunks, function() {
+          stat_cb(rc, error, null);
+        });
+      }
+    }
+  };
+
+  // a_get_large(path, cb(rc, error, stat, data))
+  // plain (non-chunked) values are returned as they are
+  ZooKeeper.prototype.a_get_large = function a_get_large(path, data_cb) {
+    var self = this;
+    if(this.logger) this.logger("Calling a_get_large on " + path);
+    var opts = options(self);
+    var attempts = 0;
+
+    function deliver(rc, error, stat, data) {
+      try {
+        data = self._decode(data);
+      } catch(e) {
+        rc = ZooKeeper.ZMARSHALLINGERROR;
+        error = 'payload is not valid JSON';
+      }
+      data_cb(rc, error, stat, data);
+    }
+
+    (function attempt() {
+      attempts++;
+      readManifest(self, path, function(rc, error, stat, raw, manifest) {
+        if(rc !== 0) return deliver(rc, error, null, null);
+        if(!manifest) return deliver(0, error, stat, raw);
+        if(manifest.pending) return deliver(ZooKeeper.ZNONODE, 'no node', null, null);
+
+        // every chunk is requested at once; the reads are pipelined on the
+        // session and land directly in their slice of one Buffer
+        var out = new Buffer(manifest.size);
+        var pending = manifest.chunks, failed = false;
+        for(var i = 0; i < manifest.chunks; i++) {
+          fetch(i);
+        }
+
+        function fetch(i) {
+          var offset = i * manifest.chunk_size;
+          var expected = Math.min(manifest.chunk_size, manifest.size - offset);
+          var rc = self._native.a_get_into(chunkPath(path, chunkTag(manifest), i), out, offset, function(rc, error, cstat, length) {
+            if(rc === 0 && length !== expected) {
+              rc = ZooKeeper.ZDATAINCONSISTENCY;
+              error = 'chunk ' + i + ' has ' + length + ' bytes, expected ' + expected;
+            }
+            done(rc, error);
+          });
+          if(rc !== 0) done(rc, 'a_get_into failed to start');
+        }
+
+        function done(rc, error) {
+          if(failed) return;
+          if(rc !== 0) {
+            failed = true;
+            return retry(rc, error);
+          }
+          if(--pending > 0) return;
+          if(sha1(out) !== manifest.sha1) {
+            return retry(ZooKeeper.ZDATAINCONSISTENCY, 'checksum mismatch for generation ' + manifest.generation);
+          }
+          deliver(0, 'ok', stat, out);
+        }
+
+        // a concurrent writer may have replaced (and removed) the generation
+        // we were reading; start over from the new manifest
+        function retry(rc, error) {
+          if(attempts <= opts.read_retries && (rc === ZooKeeper.ZNONODE || rc === ZooKeeper.ZDATAINCONSISTENCY)) {
+            return attempt();
+          }
+          deliver(rc, error, null, null);
+        }
+      });
+    })();
+  };
+
+  // a_delete_large_(path, version, cb(rc, error))
+  // nothing is removed unless version matches
+  ZooKeeper.prototype.a_delete_large_ = function a_delete_large_(path, version, void_cb) {
+    var self = this;
+    if(this.logger) this.logger("Calling a_delete_large_ on " + path);
+    readManifest(self, path, function(rc, error, stat, raw, manifest) {
+      if(rc !== 0) return void_cb(rc, error);
+      var chunks = manifest && manifest.chunks ? chunkDeletes(path, manifest) : [];
+      if(chunks.length + 2 <= DELETE_BATCH) {
+        // one transaction: the version check guards the chunk deletes too
+        var ops = [{ op: 'check', path: path, version: version }].concat(chunks, [{ op: 'delete', path: path, version: version }]);
+        var rc = self._native.a_multi(ops, function(rc, error) {
+          void_cb(rc, error);
+        });
+        if(rc !== 0) void_cb(rc, 'a_multi failed to start');
+        return;
+      }
+      // too many chunks for one transaction: first swap in a pending
+      // manifest with the version check, which readers treat as absent,
+      // then remove the chunks and the znode
+      var pending = JSON.stringify({ chunked: 1, generation: manifest.generation, chunks: 0, pending: true });
+      var rc = self._native.a_set(path, pending, version, function(rc, error, stat) {
+        if(rc !== 0) return void_cb(rc, error);
+        deleteChunks(self, path, manifest, function(rc, error) {
+          if(rc !== 0) return void_cb(rc, error);
+          var rc2 = self._native.a_delete_(path, stat.version, void_cb);
+          if(rc2 !== 0) void_cb(rc2, 'a_delete_ failed to start');
+        });
+      });
+      if(rc !== 0) void_cb(rc, 'a_set failed to start');
+    });
+  };
+};
+
+module.exports.chunkPath = chunkPath;
@@ -0,0 +1,207 @@
+var net = require('net');
+var util = require('util');
+var EventEmitter = require('events').EventEmitter;
+var _ = require('lodash');
+var hosts = require('./zk_hosts');
+
+//
+// Four-letter-word probes of the ensemble members.
+//
+//   ZK.probe('zk1:2181,zk2:2181', function(err, results) {
+//     // results['zk1:2181'].outstanding, .latency_avg, ...
+//   });
+//
+//   var prober = new ZK.Prober(connect, { interval: 5000 });
+//   prober.on('probe', function(results) { ... });
+//
+// Each command is sent to the client port on a connection of its own (the
+// server closes it after the answer). mntr, stat and wchs run in parallel.
+// The answers are parsed into numbers: mntr into its keys without the zk_
+// prefix, stat into { version, latency_min, latency_avg, latency_max,
+// received, sent, connections, outstanding, zxid, mode, node_count }, wchs
+// into { connections, paths, watches }. The result for a host also has a
+// summary that is taken from mntr when it is whitelisted, else from stat:
+//
+//   { host, ok, error, rtt, mode, outstanding, latency_avg, latency_max,
+//     znodes, watches, connections, mntr, stat, wchs }
+//
+// ok is false when no command got an answer. Commands that the server
+// refuses (not whitelisted) leave their part null.
+//
+//   commands   four-letter words to send (default [ 'mntr', 'stat', 'wchs' ])
+//   timeout    per command, in ms (default 2000)
+//   interval   Prober only: ms between rounds (default 10000)
+//
+
+var DEFAULTS = {
+  commands: ['mntr', 'stat', 'wchs'],
+  timeout: 2000,
+  interval: 10000
+};
+
+// cb(err, text, ms)
+function fourLetterWord(host, cmd, timeout, cb) {
+  var hp = hosts.splitHost(host);
+  var start = Date.now(), finished = false, chunks = [];
+  var socket = net.connect(hp.port, hp.host);
+  function finish(err) {
+    if(finished) return;
+    finished = true;
+    socket.destroy();
+    cb(err, err ? null : Buffer.concat(chunks).toString('utf8'), Date.now() - start);
+  }
+  socket.setTimeout(timeout, function() { finish(new Error(cmd + ' to ' + host + ' timed out')); });
+  socket.on('connect', function() { socket.end(cmd); });
+  socket.on('data', function(chunk) { chunks.push(chunk); });
+  socket.on('end', function() { finish(null); });
+  socket.on('error', function(err) { finish(err); });
+}
+
+function number(v) {
+  var n = Number(v);
+  return v !== '' && isFinite(n) ? n : v;
+}
+
+// "zk_avg_latency\t0" lines
+function parseMntr(text) {
+  var out = {};
+  text.split('\n').forEach(function(line) {
+    var m = /^zk_(\w+)\s+(.*)$/.exec(line.trim());
+    if(m) out[m[1]] = number(m[2].trim());
+  });
+  return _.isEmpty(out) ? null : out;
+}
+
+// "Latency min/avg/max: 0/0/12", "Outstanding: 0", "Mode: follower", ...
+function parseStat(text) {
+  var out = {}, m;
+  text.split('\n').forEach(function(line) {
+    if((m = /^Zookeeper version:\s*(.*)$/.exec(line))) {
+      out.version = m[1].trim();
+    } else if((m = /^Latency min\/avg\/max:\s*([\d.]+)\/([\d.]+)\/([\d.]+)/.exec(line))) {
+      out.latency_min = Number(m[1]);
+      out.latency_avg = Number(m[2]);
+      out.latency_max = Number(m[3]);
+    } else if((m = /^Zxid:\s*(0x[0-9a-f]+)/i.exec(line))) {
+      out.zxid = parseInt(m[1], 16);
+    } else if((m = /^Mode:\s*(\w+)/.exec(line))) {
+      out.mode = m[1];
+    } else if((m = /^(Received|Sent|Connections|Outstanding|Node count):\s*(\d+)/.exec(line))) {
+      out[m[1].toLowerCase().replace(' ', '_')] = Number(m[2]);
+    }
+  });
+  return _.isEmpty(out) ? null : out;
+}
+
+// "3 connections watching 2 paths" / "Total watches:4"
+function parseWchs(text) {
+  var out = {}, m;
+  if((m = /(\d+) connections watching (\d+) paths/.exec(text))) {
+    out.connections = Number(m[1]);
+    out.paths = Number(m[2]);
+  }
+  if((m = /Total watches:\s*(\d+)/.exec(text))) {
+    out.watches = Number(m[1]);
+  }
+  return _.isEmpty(out) ? null : out;
+}
+
+var PARSERS = { mntr: parseMntr, stat: parseStat, wchs: parseWchs };
+
+// cb(result), never fails: an unreachable host has ok false
+function probeHost(host, options, cb) {
+  var o = _.defaults({}, options, DEFAULTS);
+  var result = { host: host, ok: false, error: null, rtt: Infinity };
+  var pending = o.commands.length;
+  o.commands.forEach(function(cmd) {
+    fourLetterWord(host, cmd, o.timeout, function(err, text, ms) {
+      if(err) {
+        result.error = err.message;
+      } else {
+        result.ok = true;
+        result.rtt = Math.min(result.rtt, ms);
+        result[cmd] = PARSERS[cmd] ? PARSERS[cmd](text) : text;
+      }
+      if(--pending === 0) cb(summarize(result));
+    });
+  });
+}
+
+function summarize(r) {
+  var mntr = r.mntr || {}, stat = r.stat || {}, wchs = r.wchs || {};
+  function pick(a, b) { return _.isUndefined(a) ? (_.isUndefined(b) ? null : b) : a; }
+  r.mode = pick(mntr.server_state, stat.mode);
+  r.outstanding = pick(mntr.outstanding_requests, stat.outstanding);
+  r.latency_avg = pick(mntr.avg_latency, stat.latency_avg);
+  r.latency_max = pick(mntr.max_latency, stat.latency_max);
+  r.znodes = pick(mntr.znode_count, stat.node_count);
+  r.watches = pick(mntr.watch_count, wchs.watches);
+  r.connections = pick(mntr.num_alive_connections, stat.connections);
+  if(r.ok) r.error = null;
+  return r;
+}
+
+// probe(connect, [options,] cb(err, results)), results keyed by host
+function probe(connect, options, cb) {
+  if(_.isFunction(options)) {
+    cb = options;
+    options = {};
+  }
+  var list = hosts.parseConnect(connect).hosts;
+  var results = {}, pending = list.length;
+  if(!pending) return process.nextTick(function() { cb(new Error('no hosts in ' + connect), results); });
+  list.forEach(function(host) {
+    probeHost(host, options, function(result) {
+      results[host] = result;
+      if(--pending === 0) cb(null, results);
+    });
+  });
+}
+
+// Probes every host each interval ms; 'probe' events carry the results.
+function Prober(connect, options) {
+  EventEmitter.call(this);
+  this.connect = connect;
+  this.options = _.defaults({}, options, DEFAULTS);
+  this.results = null;
+  this.timer = null;
+  this.running = false;
+  this.start();
+}
+util.inherits(Prober, EventEmitter);
+
+Prober.prototype.start = function start() {
+  var self = this;
+  if(self.timer) return;
+  self.round();
+  self.timer = setInterval(function() { self.round(); }, self.options.interval);
+  if(self.timer.unref) self.timer.unref();
+};
+
+Prober.prototype.round = function round() {
+  var self = this;
+  if(self.running) return;    // the previous round is still waiting on a timeout
+  self.running = true;
+  probe(self.connect, self.options, function(err, results) {
+    self.running = false;
+    if(!self.timer) return;
+    self.results = results;
+    self.emit('probe', results);
+  });
+};
+
+Prober.prototype.stop = function stop() {
+  if(this.timer) clearInterval(this.timer);
+  this.timer = null;
+};
+
+module.exports = function(ZooKeeper) {
+  ZooKeeper.probe = probe;
+  ZooKeeper.Prober = Prober;
+};
+
+module.exports.probe = probe;
+module.exports.probeHost = probeHost;
+module.exports.parseMntr = parseMntr;
+module.exports.parseStat = parseStat;
+module.exports.parseWchs = parseWchs;
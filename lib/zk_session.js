@@ -0,0 +1,205 @@
+var fs = require('fs');
+var _ = require('lodash');
+
+//
+// Resumable sessions: with init({ session_file: '/path/to/state.json' }) the
+// client id, password and the watches registered through this handle are
+// persisted locally.
+//
+// On the next start a session that is still alive (the process exited
+// without close()) is reattached with the saved credentials. The watches
+// are then re-armed in one pipelined burst: one a_exists per data or exists
+// watch and one a_get_children2 per child watch. Each watch remembers the
+// zxid it last observed (mzxid for data watches, pzxid for child watches),
+// and the fresh stat is compared with it, so only znodes modified since
+// then produce a 'changed'/'created'/'deleted'/'child' event. The
+// application re-reads just those instead of the whole tree.
+//
+// close() ends the session on the server, so it keeps only the watches. If
+// there are no credentials, or the saved session has expired, a fresh
+// session is opened and the watches are restored in the same way.
+//
+
+var KINDS = ['data', 'exists', 'child'];
+var FILE_MODE = parseInt('600', 8);  // the file holds the session password
+
+function SessionStore(ZooKeeper, zk, file) {
+  this.ZK = ZooKeeper;
+  this.zk = zk;
+  this.file = file;
+  this.watches = {};     // path -> { data: zxid, exists: zxid, child: zxid }
+  this.client_id = undefined;
+  this.client_password = undefined;
+  this.restoring = false;
+  this.everConnected = false;
+  this.flushTimer = null;
+}
+
+SessionStore.prototype.load = function load() {
+  var state;
+  try {
+    state = JSON.parse(fs.readFileSync(this.file, 'utf8'));
+  } catch(e) {
+    return null;
+  }
+  this.client_id = state.client_id;
+  this.client_password = state.client_password;
+  this.watches = state.watches || {};
+  this.restoring = !_.isEmpty(this.watches);
+  return state;
+};
+
+SessionStore.prototype.save = function save() {
+  var self = this;
+  if(self.flushTimer) {
+    clearTimeout(self.flushTimer);
+    self.flushTimer = null;
+  }
+  var tmp = self.file + '.tmp';
+  try {
+    // mode only applies to a new file, so never reuse a stale one
+    if(fs.existsSync(tmp)) fs.unlinkSync(tmp);
+    fs.writeFileSync(tmp, JSON.stringify({
+      client_id: self.client_id,
+      client_password: self.client_password,
+      watches: self.watches
+    }), { mode: FILE_MODE });
+    fs.renameSync(tmp, self.file);
+  } catch(e) {
+    if(self.zk.logger) self.zk.logger("session_file: failed to save " + self.file + ": " + e.message);
+  }
+};
+
+// Coalesces the saves triggered by bursts of watch registrations.
+SessionStore.prototype.saveSoon = function saveSoon() {
+  var self = this;
+  if(self.flushTimer) return;
+  self.flushTimer = setTimeout(function() {
+    self.flushTimer = null;
+    self.save();
+  }, 1000);
+  if(self.flushTimer.unref) self.flushTimer.unref();
+};
+
+function statZxid(kind, stat) {
+  if(!stat) return 0;
+  return kind === 'child' ? stat.pzxid : stat.mzxid;
+}
+
+SessionStore.prototype.record = function record(kind, path, stat) {
+  var w = this.watches[path] || (this.watches[path] = {});
+  w[kind] = statZxid(kind, stat);
+  this.saveSoon();
+};
+
+// A watch is one-shot: once it fires it is gone until the app re-arms it.
+SessionStore.prototype.fired = function fired(event, path) {
+  var w = this.watches[path];
+  if(!w) return;
+  if(event === 'child') {
+    delete w.child;
+  } else if(event === 'deleted') {
+    delete w.data;
+    delete w.exists;
+    delete w.child;
+  } else {
+    delete w.data;
+    delete w.exists;
+  }
+  if(_.isEmpty(w)) delete this.watches[path];
+  this.saveSoon();
+};
+
+SessionStore.prototype.connected = function connected() {
+  this.client_id = this.zk.client_id;
+  this.client_password = this.zk.client_password;
+  this.save();
+  if(this.restoring) {
+    this.restoring = false;
+    this.restore();
+  }
+};
+
+// Re-arms every saved watch and reports the znodes that changed meanwhile.
+SessionStore.prototype.restore = function restore() {
+  var self = this, zk = self.zk;
+  var saved = self.watches;
+  var paths = _.keys(saved);
+  var pending = 0, changed = 0;
+  self.watches = {};
+
+  function emit(ev, path) {
+    changed++;
+    zk.emit(ev, zk._native, path);
+  }
+
+  function done() {
+    if(--pending > 0) return;
+    self.save();
+    zk.emit('restored', { watches: paths.length, changed: changed });
+  }
+
+  paths.forEach(function(path) {
+    var w = saved[path];
+    KINDS.forEach(function(kind) {
+      if(_.isUndefined(w[kind])) return;
+      var seen = w[kind];
+      pending++;
+      if(kind === 'child') {
+        zk.a_get_children2(path, true, function(rc, error, children, stat) {
+          if(rc === 0 && (!seen || stat.pzxid > seen)) emit('child', path);
+          if(rc === self.ZK.ZNONODE) emit('deleted', path);
+          done();
+        });
+      } else {
+        // an exists watch fires on create, change and delete, which
+        // covers both data and exists watches
+        zk.a_exists(path, true, function(rc, error, stat) {
+          if(rc === 0 && seen && stat.mzxid > seen) emit('changed', path);
+          if(rc === 0 && !seen && kind === 'data') emit('changed', path);
+          if(rc === 0 && !seen && kind === 'exists') emit('created', path);
+          if(rc === self.ZK.ZNONODE && seen) emit('deleted', path);
+          done();
+        });
+      }
+    });
+  });
+  if(!pending) {
+    pending = 1;
+    done();
+  }
+};
+
+// Sees every event the native handle emits. Returns false to swallow it.
+SessionStore.prototype.event = function event(ev, a1, a2) {
+  var self = this, zk = self.zk;
+  if(ev === 'connect') {
+    self.everConnected = true;
+    self.connected();
+  } else if(ev === 'created' || ev === 'deleted' || ev === 'changed' || ev === 'child') {
+    self.fired(ev, a2);
+  } else if(ev === 'close') {
+    var reattachFailed = (a2 === self.ZK.ZOO_EXPIRED_SESSION_STATE && !self.everConnected && self.client_id);
+    self.closed(a2);
+    if(reattachFailed) {
+      // the saved session expired while we were down: open a new one
+      if(zk.logger) zk.logger("session_file: saved session has expired, opening a new one");
+      process.nextTick(function() {
+        zk._reopen();
+      });
+      return false;
+    }
+  }
+};
+
+SessionStore.prototype.closed = function closed(code) {
+  if(this.flushTimer) clearTimeout(this.flushTimer);
+  this.flushTimer = null;
+  // after an expiry or a close() the session is gone on the server: the
+  // credentials are useless, the watches are still worth restoring
+  this.client_id = this.client_password = undefined;
+  this.restoring = !_.isEmpty(this.watches);
+  this.save();
+};
+
+module.exports = SessionStore;
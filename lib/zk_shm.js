@@ -0,0 +1,226 @@
+var util = require('util');
+var EventEmitter = require('events').EventEmitter;
+var _ = require('lodash');
+var NativeShared = require(__dirname + '/../build/zookeeper.node').SharedConfig;
+
+//
+// Shared config files: one session follows a subtree and publishes it into
+// a memory-mapped file, and every process on the host reads it from there
+// without a session or a round trip.
+//
+//   var pub = zk.publish_config('/config', '/dev/shm/myapp.config');
+//   pub.on('publish', function(info) { ... });      // { generation, nodes }
+//
+//   var config = ZK.open_shared_config('/dev/shm/myapp.config');
+//   config.get('/config/db/url');                    // Buffer or null
+//
+// The file layout and the seqlock that keeps lookups consistent while the
+// publisher rewrites the file are in src/zk_shm.h. That header is also all
+// a C or C++ reader needs.
+//
+// The publisher follows each znode with aw_get for its data and
+// watch_children for its children. Changes that arrive within
+// publish_delay ms of each other go out as one publish, and nothing is
+// published while reads are outstanding, so readers never see half of an
+// update that arrived in one burst.
+//
+//   publish_delay   ms to gather changes before a publish (default 10)
+//
+// If the session closes, the publisher stops and emits 'end'. The file
+// keeps the last snapshot, so readers go on with the last known config
+// until a new publisher takes over.
+//
+
+var DEFAULTS = {
+  publish_delay: 10
+};
+
+function child(path, name) {
+  return (path === '/' ? '' : path) + '/' + name;
+}
+
+function under(path, root) {
+  return path === root || path.indexOf(root === '/' ? '/' : root + '/') === 0;
+}
+
+function ConfigPublisher(ZooKeeper, zk, root, file, options) {
+  EventEmitter.call(this);
+  this.ZK = ZooKeeper;
+  this.zk = zk;
+  this.root = String(root);
+  this.options = _.defaults({}, options, DEFAULTS);
+  this.shared = new NativeShared(file, true);
+  this.nodes = {};        // path -> { path, data, version, mzxid }
+  this.children = {};     // followed path -> { name: true }
+  this.subs = {};         // followed path -> diff_cb given to watch_children
+  this.pending = 0;       // reads outstanding
+  this.timer = null;
+  this.awaiting = false;  // the root is gone, an aw_exists waits for it
+  this.closed = false;
+  this.onClose = this.close.bind(this);
+}
+util.inherits(ConfigPublisher, EventEmitter);
+
+ConfigPublisher.prototype.start = function start() {
+  this.zk.on('close', this.onClose);
+  this.follow(this.root);
+};
+
+ConfigPublisher.prototype.follow = function follow(path) {
+  var self = this, ZK = self.ZK;
+  if(self.subs[path]) return;
+  var sub = function(rc, error, added, removed, full) {
+    if(sub.waiting) {
+      sub.waiting = false;
+      self.pending--;
+    }
+    if(self.closed || self.subs[path] !== sub) return;
+    if(rc === ZK.ZNONODE) {
+      self.drop(path);
+    } else if(rc === 0) {
+      var known = self.children[path] || (self.children[path] = {});
+      if(full) {
+        // after a reconnect: whatever is not listed went away meanwhile
+        removed = _.difference(_.keys(known), added);
+      }
+      removed.forEach(function(name) {
+        delete known[name];
+        self.drop(child(path, name));
+      });
+      added.forEach(function(name) {
+        known[name] = true;
+        self.follow(child(path, name));
+      });
+    } else if(self.zk.logger) {
+      self.zk.logger("publish_config: watch_children " + path + " failed: " + error);
+    }
+    self.changed();
+  };
+  sub.waiting = true;       // for the first child list
+  self.subs[path] = sub;
+  self.pending++;
+  self.fetch(path);
+  var rc = self.zk.watch_children(path, sub);
+  if(rc !== 0) sub(rc, 'watch_children failed to start');
+};
+
+ConfigPublisher.prototype.fetch = function fetch(path) {
+  var self = this, ZK = self.ZK;
+  var watcher = function(type) {
+    if(self.closed || !self.subs[path]) return;
+    if(type === ZK.ZOO_CHANGED_EVENT) {
+      self.fetch(path);
+    } else if(type === ZK.ZOO_DELETED_EVENT) {
+      self.drop(path);
+      self.changed();
+    }
+  };
+  self.pending++;
+  // the native method: the file holds the bytes, whatever the encoding
+  var rc = self.zk._native.aw_get(path, watcher, function(rc, error, stat, data) {
+    self.pending--;
+    if(self.closed) return;
+    if(rc === 0 && self.subs[path]) {
+      self.nodes[path] = { path: path, data: data, version: stat.version, mzxid: stat.mzxid };
+    } else if(rc === ZK.ZNONODE) {
+      self.drop(path);
+    } else if(rc !== 0 && self.zk.logger) {
+      self.zk.logger("publish_config: aw_get " + path + " failed: " + error);
+    }
+    self.changed();
+  });
+  if(rc !== 0) {
+    self.pending--;
+    self.changed();
+  }
+};
+
+// Forgets path and everything below it.
+ConfigPublisher.prototype.drop = function drop(path) {
+  var self = this;
+  _.keys(self.nodes).forEach(function(p) {
+    if(under(p, path)) delete self.nodes[p];
+  });
+  _.keys(self.subs).forEach(function(p) {
+    if(!under(p, path)) return;
+    if(self.subs[p].waiting) {
+      self.subs[p].waiting = false;
+      self.pending--;
+    }
+    self.zk.unwatch_children(p, self.subs[p]);
+    delete self.subs[p];
+    delete self.children[p];
+  });
+  if(path === self.root) self.awaitRoot();
+};
+
+// The root is gone: follow it again once it is created.
+ConfigPublisher.prototype.awaitRoot = function awaitRoot() {
+  var self = this, ZK = self.ZK;
+  if(self.awaiting) return;
+  self.awaiting = true;
+  var back = function() {
+    if(self.closed || !self.awaiting) return;
+    self.awaiting = false;
+    self.follow(self.root);
+  };
+  self.zk.aw_exists(self.root, function(type) {
+    if(type === ZK.ZOO_CREATED_EVENT) back();
+  }, function(rc) {
+    if(rc === 0) back();
+  });
+};
+
+ConfigPublisher.prototype.changed = function changed() {
+  var self = this;
+  if(self.closed || self.pending > 0 || self.timer) return;
+  self.timer = setTimeout(function() {
+    self.timer = null;
+    if(self.pending > 0) return;   // the last read to complete schedules again
+    self.publish();
+  }, self.options.publish_delay);
+};
+
+ConfigPublisher.prototype.publish = function publish() {
+  if(this.closed) return;
+  var nodes = _.values(this.nodes);
+  try {
+    var generation = this.shared.publish(nodes);
+    this.emit('publish', { generation: generation, nodes: nodes.length });
+  } catch(e) {
+    this.emit('error', e);
+  }
+};
+
+// Stops following the subtree. The file keeps the last snapshot.
+ConfigPublisher.prototype.close = function close() {
+  var self = this;
+  if(self.closed) return;
+  self.closed = true;
+  if(self.timer) clearTimeout(self.timer);
+  self.zk.removeListener('close', self.onClose);
+  _.keys(self.subs).forEach(function(p) {
+    self.zk.unwatch_children(p, self.subs[p]);
+  });
+  self.subs = {};
+  self.shared.close();
+  self.emit('end');
+};
+
+module.exports = function(ZooKeeper) {
+  ZooKeeper.SharedConfig = NativeShared;
+
+  // open_shared_config(file): read-only, needs no session
+  ZooKeeper.open_shared_config = function open_shared_config(file) {
+    return new NativeShared(file, false);
+  };
+
+  // publish_config(root, file, [options]), returns an EventEmitter with
+  // 'publish' events
+  ZooKeeper.prototype.publish_config = function publish_config(root, file, options) {
+    if(this.logger) this.logger("Calling publish_config with " + util.inspect(arguments));
+    var publisher = new ConfigPublisher(ZooKeeper, this, root, file, options);
+    publisher.start();
+    return publisher;
+  };
+};
@@ -0,0 +1,431 @@
+var fs = require('fs');
+var util = require('util');
+var EventEmitter = require('events').EventEmitter;
+var _ = require('lodash');
+
+//
+// Compact tree snapshots and a bulk importer.
+//
+// A snapshot file is the magic "ZKSNAP", a version byte, then tagged
+// records, all integers big endian:
+//
+//   'A' u16 ref, u16 count, count x (u32 perms, u16 len, scheme, u16 len, id)
+//                                          an ACL list, referenced by later nodes
+//   'N' u16 len, path, u32 flags, u16 acl ref (0xffff: open ACL), u32 len, data
+//                                          a znode; parents come before children
+//   'E'                                    end of snapshot
+//
+// The importer streams the file and packs creates into a_multi batches of at
+// most batch_bytes / batch_ops. Up to in_flight batches are pipelined on the
+// session, which applies them in order, so a child may sit in the batch
+// right behind its parent's. ACL lists become native Acl handles once. With
+// a checkpoint file the importer records the offset after the last batch
+// committed, and a rerun continues from there.
+//
+// A batch that fails with ZNODEEXISTS overlaps nodes that are already there,
+// e.g. after an interrupted run. The batches behind it are on the wire by
+// then, and those holding children of its new nodes fail with ZNONODE. The
+// importer stops issuing, waits for every batch in flight, replays the
+// failed batch one create at a time and then re-issues the later failed
+// batches in order, before it goes on pipelining.
+//
+
+var MAGIC = 'ZKSNAP';
+var VERSION = 1;
+var OPEN_ACL = 0xffff;
+
+var DEFAULTS = {
+  batch_bytes: 512 * 1024,
+  batch_ops: 1000,
+  in_flight: 4,
+  ephemerals: false,    // ephemerals would belong to the importing session
+  checkpoint: null
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Writer
+////////////////////////////////////////////////////////////////////////////////
+
+function SnapshotWriter(file) {
+  this.fd = fs.openSync(file, 'w');
+  this.refs = 0;
+  this.write(Buffer.concat([new Buffer(MAGIC, 'ascii'), new Buffer([VERSION])]));
+}
+
+SnapshotWriter.prototype.write = function write(buf) {
+  fs.writeSync(this.fd, buf, 0, buf.length, null);
+};
+
+// Defines an ACL list and returns its ref for node().
+SnapshotWriter.prototype.acl = function acl(list) {
+  var ref = this.refs++;
+  var parts = [new Buffer(5)];
+  parts[0].write('A', 0, 'ascii');
+  parts[0].writeUInt16BE(ref, 1);
+  parts[0].writeUInt16BE(list.length, 3);
+  list.forEach(function(a) {
+    var scheme = new Buffer(String(a.scheme), 'utf8');
+    var id = new Buffer(String(a.auth), 'utf8');
+    var b = new Buffer(8 + scheme.length + id.length);
+    b.writeUInt32BE(a.perms, 0);
+    b.writeUInt16BE(scheme.length, 4);
+    scheme.copy(b, 6);
+    b.writeUInt16BE(id.length, 6 + scheme.length);
+    id.copy(b, 8 + scheme.length);
+    parts.push(b);
+  });
+  this.write(Buffer.concat(parts));
+  return ref;
+};
+
+SnapshotWriter.prototype.node = function node(path, data, flags, aclRef) {
+  var p = new Buffer(path, 'utf8');
+  var d = Buffer.isBuffer(data) ? data : new Buffer(data ? String(data) : '', 'utf8');
+  var b = new Buffer(13 + p.length + d.length);
+  b.write('N', 0, 'ascii');
+  b.writeUInt16BE(p.length, 1);
+  p.copy(b, 3);
+  b.writeUInt32BE(flags || 0, 3 + p.length);
+  b.writeUInt16BE(_.isUndefined(aclRef) ? OPEN_ACL : aclRef, 7 + p.length);
+  b.writeUInt32BE(d.length, 9 + p.length);
+  d.copy(b, 13 + p.length);
+  this.write(b);
+};
+
+SnapshotWriter.prototype.end = function end() {
+  this.write(new Buffer('E', 'ascii'));
+  fs.closeSync(this.fd);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Reader
+////////////////////////////////////////////////////////////////////////////////
+
+// Incremental parser; feed() chunks, then next() until it returns null.
+function SnapshotParser() {
+  this.buf = new Buffer(0);
+  this.pos = 0;
+  this.base = 0;        // file offset of buf[0]
+  this.started = false;
+}
+
+SnapshotParser.prototype.feed = function feed(chunk) {
+  this.base += this.pos;
+  this.buf = Buffer.concat([this.buf.slice(this.pos), chunk]);
+  this.pos = 0;
+};
+
+SnapshotParser.prototype.offset = function offset() {
+  return this.base + this.pos;
+};
+
+SnapshotParser.prototype.next = function next() {
+  var b = this.buf, p = this.pos;
+  if(!this.started) {
+    if(b.length < 7) return null;
+    if(b.toString('ascii', 0, 6) !== MAGIC || b[6] !== VERSION) {
+      throw new Error('not a version ' + VERSION + ' snapshot');
+    }
+    this.started = true;
+    this.pos = p = 7;
+  }
+  if(p >= b.length) return null;
+  var tag = String.fromCharCode(b[p]);
+  if(tag === 'E') {
+    this.pos = p + 1;
+    return { type: 'end' };
+  }
+  if(tag === 'N') {
+    if(p + 3 > b.length) return null;
+    var plen = b.readUInt16BE(p + 1);
+    if(p + 13 + plen > b.length) return null;
+    var dlen = b.readUInt32BE(p + 9 + plen);
+    if(p + 13 + plen + dlen > b.length) return null;
+    this.pos = p + 13 + plen + dlen;
+    return {
+      type: 'node',
+      path: b.toString('utf8', p + 3, p + 3 + plen),
+      flags: b.readUInt32BE(p + 3 + plen),
+      acl: b.readUInt16BE(p + 7 + plen),
+      data: b.slice(p + 13 + plen, p + 13 + plen + dlen)
+    };
+  }
+  if(tag === 'A') {
+    if(p + 5 > b.length) return null;
+    var ref = b.readUInt16BE(p + 1), count = b.readUInt16BE(p + 3), q = p + 5, list = [];
+    for(var i = 0; i < count; i++) {
+      if(q + 6 > b.length) return null;
+      var slen = b.readUInt16BE(q + 4);
+      if(q + 8 + slen > b.length) return null;
+      var ilen = b.readUInt16BE(q + 6 + slen);
+      if(q + 8 + slen + ilen > b.length) return null;
+      list.push({
+        perms: b.readUInt32BE(q),
+        scheme: b.toString('utf8', q + 6, q + 6 + slen),
+        auth: b.toString('utf8', q + 8 + slen, q + 8 + slen + ilen)
+      });
+      q += 8 + slen + ilen;
+    }
+    this.pos = q;
+    return { type: 'acl', ref: ref, list: list };
+  }
+  throw new Error('corrupt snapshot at offset ' + this.offset());
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Importer
+////////////////////////////////////////////////////////////////////////////////
+
+function Importer(ZooKeeper, zk, file, options) {
+  EventEmitter.call(this);
+  this.ZK = ZooKeeper;
+  this.zk = zk;
+  this.file = file;
+  this.options = _.defaults({}, options, DEFAULTS);
+  this.acls = {};
+  this.batch = null;
+  this.pending = [];      // batches in flight, oldest first
+  this.nodes = 0;         // nodes created (or found existing) so far
+  this.skipped = 0;
+  this.resumeAt = 0;
+  this.streamEnded = false;
+  this.parsedAll = false;
+  this.stalled = false;   // a batch overlapped existing nodes: recovering
+  this.recovering = false;
+  this.done = false;
+  this.started = Date.now();
+}
+util.inherits(Importer, EventEmitter);
+
+Importer.prototype.loadCheckpoint = function loadCheckpoint() {
+  if(!this.options.checkpoint) return;
+  try {
+    var c = JSON.parse(fs.readFileSync(this.options.checkpoint, 'utf8'));
+    if(c.file === this.file) {
+      this.resumeAt = c.offset;
+      this.nodes = c.nodes;
+    }
+  } catch(e) {
+  }
+};
+
+Importer.prototype.saveCheckpoint = function saveCheckpoint(offset) {
+  if(!this.options.checkpoint) return;
+  var tmp = this.options.checkpoint + '.tmp';
+  fs.writeFileSync(tmp, JSON.stringify({ file: this.file, offset: offset, nodes: this.nodes }));
+  fs.renameSync(tmp, this.options.checkpoint);
+};
+
+Importer.prototype.start = function start(cb) {
+  var self = this;
+  self.cb = cb;
+  self.loadCheckpoint();
+  var parser = self.parser = new SnapshotParser();
+  var stream = self.stream = fs.createReadStream(self.file, { highWaterMark: 256 * 1024 });
+  stream.on('data', function(chunk) {
+    parser.feed(chunk);
+    self.drain();
+  });
+  stream.on('end', function() {
+    self.streamEnded = true;
+    self.drain();
+  });
+  stream.on('error', function(e) {
+    self.finish(e);
+  });
+};
+
+// Parses and batches records while fewer than in_flight batches are out;
+// the file stream is paused while the window is full.
+Importer.prototype.drain = function drain() {
+  var exhausted = false;
+  try {
+    while(!this.done && !this.stalled && !this.parsedAll && this.pending.length < this.options.in_flight) {
+      var start = this.parser.offset();
+      var rec = this.parser.next();
+      if(!rec) {
+        exhausted = true;
+        break;
+      }
+      if(rec.type === 'acl') {
+        this.acls[rec.ref] = this.ZK.acl(rec.list);
+      } else if(rec.type === 'node') {
+        if(start >= this.resumeAt) this.add(rec, start);
+      } else {
+        this.parsedAll = true;
+      }
+    }
+    if(exhausted && this.streamEnded) {
+      throw new Error('truncated snapshot at offset ' + this.parser.offset());
+    }
+  } catch(e) {
+    return this.finish(e);
+  }
+  if(this.done) return;
+  if(this.parsedAll) {
+    this.flush();
+    this.maybeDone();
+  } else if(this.stalled || this.pending.length >= this.options.in_flight) {
+    this.stream.pause();
+  } else {
+    this.stream.resume();
+  }
+};
+
+Importer.prototype.add = function add(rec, start) {
+  var opts = this.options, ZK = this.ZK;
+  if(rec.path === '/' || ((rec.flags & ZK.ZOO_EPHEMERAL) && !opts.ephemerals)) {
+    this.skipped++;
+    return;
+  }
+  if(this.batch && (this.batch.ops.length >= opts.batch_ops || this.batch.bytes + rec.data.length > opts.batch_bytes)) {
+    this.flush();
+  }
+  if(!this.batch) {
+    this.batch = { ops: [], bytes: 0, start: start };
+  }
+  this.batch.ops.push({
+    op: 'create',
+    path: rec.path,
+    data: rec.data,
+    // the path already carries its sequence suffix
+    flags: rec.flags & ~ZK.ZOO_SEQUENCE,
+    acl: rec.acl === OPEN_ACL ? undefined : this.acls[rec.acl]
+  });
+  this.batch.bytes += rec.data.length + rec.path.length;
+  this.batch.end = this.parser.offset();
+};
+
+// Sends the current batch; while recovering it waits in this.batch.
+Importer.prototype.flush = function flush() {
+  var self = this, batch = self.batch;
+  if(!batch || self.done || self.stalled) return;
+  self.batch = null;
+  self.pending.push(batch);
+  batch.sent = true;
+
+  var rc = self.zk.a_multi(batch.ops, function(rc, error) {
+    batch.sent = false;
+    self.answered(batch, rc, error);
+  });
+  if(rc !== 0) {
+    batch.sent = false;
+    self.completed(batch, rc, 'a_multi failed to start');
+  }
+};
+
+Importer.prototype.answered = function answered(batch, rc, error) {
+  var ZK = this.ZK;
+  if(rc === ZK.ZNODEEXISTS) this.stalled = true;
+  if(this.stalled && (rc === ZK.ZNODEEXISTS || rc === ZK.ZNONODE)) {
+    batch.rc = rc;
+  } else {
+    this.completed(batch, rc, error);
+  }
+  if(this.stalled) this.recover();
+};
+
+// Once no batch is in flight, redoes the failed batches one after the
+// other: a ZNODEEXISTS batch create by create, a ZNONODE batch as a whole
+// again (and create by create if it now overlaps existing nodes).
+Importer.prototype.recover = function recover() {
+  var self = this, ZK = self.ZK;
+  if(self.done || self.recovering || _.some(self.pending, 'sent')) return;
+  var batch = _.find(self.pending, function(b) { return !b.committed; });
+  if(!batch) {
+    self.stalled = false;
+    return self.drain();
+  }
+  self.recovering = true;
+  function redone(rc, error) {
+    self.recovering = false;
+    self.completed(batch, rc, error);
+    self.recover();
+  }
+  if(batch.rc === ZK.ZNODEEXISTS) return self.createOneByOne(batch, redone);
+  var rc = self.zk.a_multi(batch.ops, function(rc, error) {
+    if(rc === ZK.ZNODEEXISTS) return self.createOneByOne(batch, redone);
+    redone(rc, error);
+  });
+  if(rc !== 0) redone(rc, 'a_multi failed to start');
+};
+
+// Slow path for a batch that overlaps existing nodes; cb(rc, error).
+Importer.prototype.createOneByOne = function createOneByOne(batch, done) {
+  var self = this, i = 0;
+  (function next() {
+    if(i === batch.ops.length) return done(0, 'ok');
+    var op = batch.ops[i++];
+    var cb = function(rc, error) {
+      if(rc !== 0 && rc !== self.ZK.ZNODEEXISTS) return done(rc, error + ' creating ' + op.path);
+      next();
+    };
+    var rc = op.acl ? self.zk.a_create(op.path, op.data, op.flags, op.acl, cb) : self.zk.a_create(op.path, op.data, op.flags, cb);
+    if(rc !== 0) cb(rc, 'a_create failed to start');
+  })();
+};
+
+Importer.prototype.completed = function completed(batch, rc, error) {
+  var self = this;
+  if(self.done) return;
+  if(rc !== 0) {
+    var err = new Error(error);
+    err.rc = rc;
+    return self.finish(err);
+  }
+  batch.committed = true;
+  // batches are applied in session order; advance the checkpoint over the
+  // committed prefix only
+  while(self.pending.length && self.pending[0].committed) {
+    var b = self.pending.shift();
+    self.nodes += b.ops.length;
+    self.saveCheckpoint(b.end);
+  }
+  var elapsed = (Date.now() - self.started) / 1000;
+  self.emit('progress', {
+    nodes: self.nodes,
+    offset: batch.end,
+    elapsed: elapsed,
+    ops_per_sec: elapsed > 0 ? Math.round(self.nodes / elapsed) : 0
+  });
+  self.drain();
+};
+
+Importer.prototype.maybeDone = function maybeDone() {
+  if(this.parsedAll && !this.batch && this.pending.length === 0) this.finish(null);
+};
+
+Importer.prototype.finish = function finish(err) {
+  if(this.done) return;
+  this.done = true;
+  if(this.stream) this.stream.destroy();
+  if(!err && this.options.checkpoint) {
+    try { fs.unlinkSync(this.options.checkpoint); } catch(e) { }
+  }
+  var elapsed = (Date.now() - this.started) / 1000;
+  var summary = { nodes: this.nodes, skipped: this.skipped, elapsed: elapsed, ops_per_sec: elapsed > 0 ? Math.round(this.nodes / elapsed) : 0 };
+  if(this.cb) {
+    this.cb(err, summary);
+  } else if(err) {
+    this.emit('error', err);
+  }
+  if(!err) this.emit('end', summary);
+};
+
+module.exports = function(ZooKeeper) {
+  // import_snapshot(file, [options,] cb(err, summary)), returns an
+  // EventEmitter with 'progress' events
+  ZooKeeper.prototype.import_snapshot = function import_snapshot(file, options, cb) {
+    if(this.logger) this.logger("Calling import_snapshot with " + util.inspect(arguments));
+    if(_.isFunction(options)) {
+      cb = options;
+      options = {};
+    }
+    var importer = new Importer(ZooKeeper, this, file, options);
+    importer.start(cb);
+    return importer;
+  };
+};
+
+module.exports.SnapshotWriter = SnapshotWriter;
+module.exports.SnapshotParser = SnapshotParser;
@@ -0,0 +1,87 @@
+var Readable = require('stream').Readable;
+var util = require('util');
+var _ = require('lodash');
+
+//
+// Subtree traversal as an object-mode Readable stream:
+//
+//   zk.walk('/app', { depth: 3, data: false }).on('data', function(rec) {
+//     // rec = { path, stat, data }
+//   });
+//
+// The native walker visits the subtree breadth-first and keeps at most
+// `window` requests in flight. When the stream's buffer is full the walker
+// is paused, and it resumes when the consumer reads again, so memory stays
+// bounded by highWaterMark + window records.
+//
+//   depth      levels below root to visit (default unlimited, 0 = root only)
+//   data       include node data (default true); false reads stat only,
+//              with one request per znode
+//   window     requests in flight (default 64)
+//   exclude    paths whose subtrees are skipped entirely
+//   filter     function(path, stat) returning false drops the record; the
+//              subtree below it is still walked
+//
+
+function TreeWalk(zk, root, options) {
+  options = options || {};
+  Readable.call(this, { objectMode: true, highWaterMark: options.highWaterMark || 1024 });
+  this.zk = zk;
+  this.root = root;
+  this.options = options;
+  this.filter = _.isFunction(options.filter) ? options.filter : null;
+  this.id = 0;
+  this.ended = false;
+}
+util.inherits(TreeWalk, Readable);
+
+TreeWalk.prototype._read = function _read() {
+  var self = this;
+  if(self.id) {
+    self.zk._native.walk_resume(self.id);
+    return;
+  }
+  var native = self.zk._native;
+  self.id = native.walk(self.root, _.pick(self.options, ['depth', 'data', 'window', 'exclude']), function(rc, error, path, stat, data) {
+    if(self.ended) return;
+    if(rc !== 0) {
+      self.ended = true;
+      var err = new Error(error);
+      err.rc = rc;
+      return self.emit('error', err);
+    }
+    if(path === null) {
+      self.ended = true;
+      return self.push(null);
+    }
+    if(self.filter && self.filter(path, stat) === false) return;
+    try {
+      data = self.zk._decode(data);
+    } catch(e) {
+      // not JSON: the record keeps the raw Buffer
+    }
+    if(!self.push({ path: path, stat: stat, data: data })) {
+      native.walk_pause(self.id);
+    }
+  });
+};
+
+// Stops the walk early; the stream ends without an error.
+TreeWalk.prototype.destroy = function destroy() {
+  if(this.id && !this.ended) {
+    this.zk._native.walk_cancel(this.id);
+  }
+  if(!this.ended) {
+    this.ended = true;
+    this.push(null);
+  }
+};
+
+module.exports = function(ZooKeeper) {
+  ZooKeeper.prototype.walk = function walk(root, options) {
+    if(this.logger) this.logger("Calling walk with " + util.inspect(arguments));
+    return new TreeWalk(this, root, options);
+  };
+};
+
+module.exports.TreeWalk = TreeWalk;
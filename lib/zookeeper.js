@@ -3,6 +3,11 @@ var util = require('util');
 var _ = require('lodash');
 var path = require('path');
 var NativeZk = require(__dirname + '/../build/zookeeper.node').ZooKeeper;
+var NativeAcl = require(__dirname + '/../build/zookeeper.node').Acl;
+var NativePath = require(__dirname + '/../build/zookeeper.node').Path;
+var SessionStore = require('./zk_session');
+var HostPolicy = require('./zk_hosts');
+var EphemeralRegistry = require('./zk_ephemeral');
 
 var async = {};
 async.apply = require('async/apply');
@@ -22,16 +27,7 @@ function ZooKeeper(config) {
     config = { connect: config };
   }
   self.config = config;
-  self._native = new NativeZk();
-  self._native.emit = function(ev, a1, a2, a3) {
-    if(self.logger)
-      self.logger("Emitting '" + ev + "' with args: " + a1 + ", " + a2 + ", " + a3);
-    if(ev === 'connect' || ev === 'close') {
-      // the event is passing the native object.  need to mangle to return the wrapper
-      a1 = self;
-    }
-    self.emit(ev, a1, a2, a3);
-  }
+  self._native = createNative(self);
 
   ////////////////////////////////////////////////////////////////////////////////
   // Public Properties
@@ -51,6 +47,12 @@ function ZooKeeper(config) {
   proxyProperty('client_id');
   proxyProperty('client_password');
   proxyProperty('is_unrecoverable');
+  proxyProperty('sync_stats');
+  proxyProperty('compression_stats');
+  proxyProperty('server');
+  proxyProperty('connection_stats');
+  proxyProperty('event_stats');
+  proxyProperty('deadline_stats');
 
   self.encoding = null;  // Return 'Buffer' objects by default
 
@@ -73,6 +75,55 @@ function ZooKeeper(config) {
 
 util.inherits(ZooKeeper, EventEmitter);
 
+function createNative(self) {
+  var native = new NativeZk();
+  native.emit = function(ev, a1, a2, a3) {
+    if(ev === 'batch') {
+      return emitBatch(self, native, a2);
+    }
+    if(self.logger)
+      self.logger("Emitting '" + ev + "' with args: " + a1 + ", " + a2 + ", " + a3);
+    var swallow = false;
+    if(self._session && self._session.event(ev, a1, a2) === false) {
+      swallow = true;
+    }
+    if(self._ephemerals && self._ephemerals.event(ev, a1, a2, swallow) === false) {
+      swallow = true;
+    }
+    if(swallow) {
+      return;
+    }
+    if(self._hostPolicy) {
+      self._hostPolicy.event(ev, a1, a2);
+    }
+    if(ev === 'connect' || ev === 'close' || ev === 'readonly') {
+      // the event is passing the native object.  need to mangle to return the wrapper
+      a1 = self;
+    }
+    self.emit(ev, a1, a2, a3);
+  }
+  return native;
+}
+
+// With event_coalescing the native layer delivers watch events as arrays of
+// { type, path }. Listeners of 'batch' get the array as is; individual
+// events are re-emitted only for types somebody listens to.
+function emitBatch(self, native, events) {
+  if(self.logger)
+    self.logger("Emitting 'batch' with " + events.length + " events");
+  var listened = {};
+  for(var i = 0; i < events.length; i++) {
+    var e = events[i];
+    if(self._session) self._session.event(e.type, native, e.path);
+    if(self._hostPolicy) self._hostPolicy.event(e.type, native, e.path);
+    if(!(e.type in listened)) listened[e.type] = self.listeners(e.type).length > 0;
+    if(listened[e.type]) {
+      self.emit(e.type, native, e.path);
+    }
+  }
+  self.emit('batch', events);
+}
+
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -83,12 +134,25 @@ util.inherits(ZooKeeper, EventEmitter);
 exports.on_closed             = 'close';
 exports.on_connected          = 'connect';
 exports.on_connecting         = 'connecting';
+exports.on_readonly           = 'readonly';
 exports.on_event_created      = 'created';
 exports.on_event_deleted      = 'deleted';
 exports.on_event_changed      = 'changed';
 exports.on_event_child        = 'child';
 exports.on_event_notwatching  = 'notwatching';
 
+// ACL lists compiled once into native handles, see README
+exports.Acl = NativeAcl;
+exports.acl = function acl(list) {
+  return new NativeAcl(list);
+};
+
+// Paths converted and interned once, see README
+exports.Path = NativePath;
+exports.path = function path(p) {
+  return new NativePath(p);
+};
+
 // Other Constants
 for(var key in NativeZk) {
   exports[key] = NativeZk[key];
@@ -110,6 +174,7 @@ States:
  * ZOO_CONNECTING_STATE       =  1
  * ZOO_ASSOCIATING_STATE      =  2
  * ZOO_CONNECTED_STATE        =  3
+ * ZOO_READONLY_STATE         =  5
 
 Log Levels:
  * ZOO_LOG_LEVEL_ERROR        =  1
@@ -142,6 +207,8 @@ API Responses:
  * ZCLOSING                   =  -116
  * ZNOTHING                   =  -117
  * ZSESSIONMOVED              =  -118
+ * ZNOTREADONLY               =  -119
+ * ZCANCELLED                 =  -150  (requests cancelled through a CancelToken)
 
 Dunno:
  * ZOO_EPHEMERAL              =  1
@@ -180,6 +247,31 @@ ZooKeeper.prototype.init = function init(config) {
     self.data_as_buffer = config.data_as_buffer;
     if(this.logger) this.logger("Encoding for data output: %s", self.encoding);
   }
+  if(config.session_file && !self._session) {
+    self._session = new SessionStore(ZooKeeper, self, config.session_file);
+    if(self._session.load() && _.isUndefined(config.client_id) && self._session.client_id) {
+      config = _.defaults({
+        client_id: self._session.client_id,
+        client_password: self._session.client_password
+      }, config);
+    }
+  }
+  if(config.managed_ephemerals && !self._ephemerals) {
+    self._ephemerals = new EphemeralRegistry(ZooKeeper, self, config.managed_ephemerals);
+  }
+  if(config.host_policy && !self._hostPolicy) {
+    // the order is fixed when the native handle is created, so the handle
+    // waits for the policy (rtt probes, dns) to produce it
+    var native = self._native;
+    self._hostPolicy = new HostPolicy(self, config.host_policy);
+    self._hostPolicy.order(config.connect, function(connect) {
+      config = _.defaults({ connect: connect, host_order_deterministic: true }, config);
+      self._initConfig = config;
+      if(native === self._native) native.init.call(native, config);
+    });
+    return self;
+  }
+  self._initConfig = config;
   this._native.init.call(this._native, config);
 
   // The native code returns a ref to itself.
@@ -187,6 +279,15 @@ ZooKeeper.prototype.init = function init(config) {
   return self;
 }
 
+// Replaces a dead native handle with a fresh session using the last init
+// options, minus the credentials of the old session.
+ZooKeeper.prototype._reopen = function _reopen() {
+  var config = _.omit(this._initConfig, ['client_id', 'client_password']);
+  this._native = createNative(this);
+  this._initConfig = config;
+  this._native.init.call(this._native, config);
+}
+
 ZooKeeper.prototype.connect = function connect(options, cb) {
   var self = this;
   if(_.isFunction(options)) {
@@ -198,17 +299,21 @@ ZooKeeper.prototype.connect = function connect(options, cb) {
   function errorHandler(err) {
     self.removeListener('error', errorHandler);
     self.removeListener('connect', connectHandler);
+    self.removeListener('readonly', connectHandler);
     cb(err);
   }
 
   function connectHandler() {
     self.removeListener('error', errorHandler);
     self.removeListener('connect', connectHandler);
+    self.removeListener('readonly', connectHandler);
     cb(null, self);
   }
 
   self.on('error', errorHandler);
   self.on('connect', connectHandler);
+  // a read-only capable session may only find servers without quorum
+  self.on('readonly', connectHandler);
 
 /** commenting out change initially made by  vincent-zhao
   self.a_get('/',false,function(rc,error,stat,data){
@@ -224,70 +329,121 @@ ZooKeeper.prototype.close = function close() {
   return this._native.close.apply(this._native, arguments);
 }
 
+// A session attached to a read-only server fails writes locally, through
+// the callback like any other error, instead of sending them to be refused.
+function refuseWrite(self, args) {
+  if(self.state != ZooKeeper.ZOO_READONLY_STATE) return false;
+  var cb = args[args.length - 1];
+  process.nextTick(function() {
+    cb(ZooKeeper.ZNOTREADONLY, 'session is read-only: writes need a server with quorum');
+  });
+  return true;
+}
+
 ZooKeeper.prototype.a_create = function a_create() {
   if(this.logger) this.logger("Calling a_create with " + util.inspect(arguments));
+  if(refuseWrite(this, arguments)) return ZooKeeper.ZOK;
   return this._native.a_create.apply(this._native, arguments);
 }
 
-ZooKeeper.prototype.a_exists = function a_exists() {
+// Wraps the completion of a watch-setting call so that a resumable session
+// (see zk_session.js) records the watch together with the zxid it observed.
+function trackWatch(self, kind, path, watch, statIndex, cb) {
+  if(!self._session || !watch) return cb;
+  return function(rc) {
+    if(rc == 0 || (rc == ZooKeeper.ZNONODE && kind === 'exists')) {
+      self._session.record(kind, path, statIndex >= 0 ? arguments[statIndex] : null);
+    }
+    return cb.apply(this, arguments);
+  };
+}
+
+function trackWatcher(self, path, watch_cb) {
+  if(!self._session) return watch_cb;
+  return function(type, state, p) {
+    self._session.fired(type == ZooKeeper.ZOO_CHILD_EVENT ? 'child' : (type == ZooKeeper.ZOO_DELETED_EVENT ? 'deleted' : 'changed'), path);
+    return watch_cb.apply(this, arguments);
+  };
+}
+
+ZooKeeper.prototype.a_exists = function a_exists(path, watch, stat_cb) {
   if(this.logger) this.logger("Calling a_exists with " + util.inspect(arguments));
-  return this._native.a_exists.apply(this._native, arguments);
+  return this._native.a_exists.call(this._native, path, watch, trackWatch(this, 'exists', path, watch, 2, stat_cb));
 }
 
-ZooKeeper.prototype.aw_exists = function aw_exists() {
+ZooKeeper.prototype.aw_exists = function aw_exists(path, watch_cb, stat_cb) {
   if(this.logger) this.logger("Calling aw_exists with " + util.inspect(arguments));
-  return this._native.aw_exists.apply(this._native, arguments);
+  return this._native.aw_exists.call(this._native, path, trackWatcher(this, path, watch_cb), trackWatch(this, 'exists', path, true, 2, stat_cb));
 }
 
 ZooKeeper.prototype.a_get = function a_get(path, watch, data_cb) {
   var self = this;
   if(this.logger) this.logger("Calling a_get with " + util.inspect(arguments));
-  return this._native.a_get.call(this._native, path, watch, function(rc, error, stat, data) {
-    if(data && self.encoding) {
-      data = data.toString(self.encoding);
+  // a_get(path, { watch: bool, linearizable: true, encoding: 'utf8' }, data_cb)
+  var encoding = self.encoding;
+  if(_.isObject(watch)) {
+    if(!_.isUndefined(watch.encoding)) encoding = watch.encoding;
+    if(watch.linearizable) {
+      return readData(self, 'a_get_linearizable', path, !!watch.watch, encoding, data_cb);
     }
-    data_cb(rc, error, stat, data);
-  });
+    watch = !!watch.watch;
+  }
+  return readData(self, 'a_get', path, watch, encoding, data_cb);
+}
+
+ZooKeeper.prototype.a_get_linearizable = function a_get_linearizable(path, watch, data_cb) {
+  if(this.logger) this.logger("Calling a_get_linearizable with " + util.inspect(arguments));
+  return readData(this, 'a_get_linearizable', path, watch, this.encoding, data_cb);
 }
 
 ZooKeeper.prototype.aw_get = function aw_get(path, watch_cb, data_cb) {
-  var self = this;
   if(this.logger) this.logger("Calling aw_get with " + util.inspect(arguments));
-  return this._native.aw_get.call(this._native, path, watch_cb, function(rc, error, stat, data) {
-    if(data && self.encoding) {
-      data = data.toString(self.encoding);
-    }
-    data_cb(rc, error, stat, data);
-  });
+  return this._native.aw_get.call(this._native, path, trackWatcher(this, path, watch_cb), trackWatch(this, 'data', path, true, 2, data_cb), this.encoding);
 }
 
-ZooKeeper.prototype.a_get_children = function a_get_children() {
+// The native layer decodes the value (or parses it for 'json') straight
+// from the client's buffer; a null encoding returns a Buffer.
+function readData(self, method, path, watch, encoding, data_cb) {
+  return self._native[method].call(self._native, path, watch, trackWatch(self, 'data', path, watch, 2, data_cb), encoding);
+}
+
+// The same decoding for values put together in JS (a_get_large, walk).
+// Throws a SyntaxError for a value that is not valid JSON.
+ZooKeeper.prototype._decode = function _decode(data) {
+  if(!data || !this.encoding) return data;
+  if(this.encoding !== 'json') return data.toString(this.encoding);
+  return data.length ? JSON.parse(data.toString('utf8')) : null;
+}
+
+ZooKeeper.prototype.a_get_children = function a_get_children(path, watch, child_cb) {
   if(this.logger) this.logger("Calling a_get_children with " + util.inspect(arguments));
-  return this._native.a_get_children.apply(this._native, arguments);
+  return this._native.a_get_children.call(this._native, path, watch, trackWatch(this, 'child', path, watch, -1, child_cb));
 }
 
-ZooKeeper.prototype.aw_get_children = function aw_get_children() {
+ZooKeeper.prototype.aw_get_children = function aw_get_children(path, watch_cb, child_cb) {
   if(this.logger) this.logger("Calling aw_get_children with " + util.inspect(arguments));
-  return this._native.aw_get_children.apply(this._native, arguments);
+  return this._native.aw_get_children.call(this._native, path, trackWatcher(this, path, watch_cb), trackWatch(this, 'child', path, true, -1, child_cb));
 }
 
-ZooKeeper.prototype.a_get_children2 = function a_get_children2() {
+ZooKeeper.prototype.a_get_children2 = function a_get_children2(path, watch, child2_cb) {
   if(this.logger) this.logger("Calling a_get_children with " + util.inspect(arguments));
-  return this._native.a_get_children2.apply(this._native, arguments);
+  return this._native.a_get_children2.call(this._native, path, watch, trackWatch(this, 'child', path, watch, 3, child2_cb));
 }
 
-ZooKeeper.prototype.aw_get_children2 = function aw_get_children2() {
+ZooKeeper.prototype.aw_get_children2 = function aw_get_children2(path, watch_cb, child2_cb) {
   if(this.logger) this.logger("Calling aw_get_children with " + util.inspect(arguments));
-  return this._native.aw_get_children2.apply(this._native, arguments);
+  return this._native.aw_get_children2.call(this._native, path, trackWatcher(this, path, watch_cb), trackWatch(this, 'child', path, true, 3, child2_cb));
 }
 
 ZooKeeper.prototype.a_set = function a_set() {
   if(this.logger) this.logger("Calling a_set with " + util.inspect(arguments));
+  if(refuseWrite(this, arguments)) return ZooKeeper.ZOK;
   return this._native.a_set.apply(this._native, arguments);
 }
 
 ZooKeeper.prototype.a_delete_ = function a_delete_() {
   if(this.logger) this.logger("Calling a_delete_ with " + util.inspect(arguments));
+  if(refuseWrite(this, arguments)) return ZooKeeper.ZOK;
   return this._native.a_delete_.apply(this._native, arguments);
 }
 
@@ -298,6 +454,7 @@ ZooKeeper.prototype.a_get_acl = function a_get_acl () {
 
 ZooKeeper.prototype.a_set_acl = function a_get_acl () {
   if(this.logger) this.logger("Calling a_set_acl with " + util.inspect(arguments));
+  if(refuseWrite(this, arguments)) return ZooKeeper.ZOK;
   return this._native.a_set_acl.apply(this._native, arguments);
 };
 
@@ -306,6 +463,53 @@ ZooKeeper.prototype.add_auth = function a_get_acl () {
   return this._native.add_auth.apply(this._native, arguments);
 };
 
+ZooKeeper.prototype.drop_connection = function drop_connection() {
+  if(this.logger) this.logger("Calling drop_connection with " + util.inspect(arguments));
+  return this._native.drop_connection.apply(this._native, arguments);
+};
+
+ZooKeeper.prototype.a_multi = function a_multi() {
+  if(this.logger) this.logger("Calling a_multi with " + util.inspect(arguments));
+  if(refuseWrite(this, arguments)) return ZooKeeper.ZOK;
+  return this._native.a_multi.apply(this._native, arguments);
+}
+
+// register_ephemeral(path, data, [{ flags, acl },] path_cb): an ephemeral
+// that is recreated on a new session when this one expires
+ZooKeeper.prototype.register_ephemeral = function register_ephemeral(path, data, options, cb) {
+  if(this.logger) this.logger("Calling register_ephemeral with " + util.inspect(arguments));
+  if(_.isFunction(options)) {
+    cb = options;
+    options = {};
+  }
+  if(refuseWrite(this, [cb])) return ZooKeeper.ZOK;
+  if(!this._ephemerals) this._ephemerals = new EphemeralRegistry(ZooKeeper, this, this._initConfig && this._initConfig.managed_ephemerals);
+  return this._ephemerals.create(path, data, options, cb);
+}
+
+ZooKeeper.prototype.unregister_ephemeral = function unregister_ephemeral(path, cb) {
+  if(this.logger) this.logger("Calling unregister_ephemeral with " + util.inspect(arguments));
+  if(!this._ephemerals) {
+    return this.a_delete_(path, -1, cb);
+  }
+  return this._ephemerals.remove(path, cb);
+}
+
+ZooKeeper.prototype.watch_children = function watch_children() {
+  if(this.logger) this.logger("Calling watch_children with " + util.inspect(arguments));
+  return this._native.watch_children.apply(this._native, arguments);
+}
+
+ZooKeeper.prototype.unwatch_children = function unwatch_children() {
+  if(this.logger) this.logger("Calling unwatch_children with " + util.inspect(arguments));
+  return this._native.unwatch_children.apply(this._native, arguments);
+}
+
+ZooKeeper.prototype.a_get_into = function a_get_into() {
+  if(this.logger) this.logger("Calling a_get_into with " + util.inspect(arguments));
+  return this._native.a_get_into.apply(this._native, arguments);
+}
+
 ZooKeeper.prototype.mkdirp = function (p, cb) {
   if(this.logger) this.logger("Calling mkdirp with " + util.inspect(arguments));
   return mkdirp(this, p, cb);
@@ -316,6 +520,17 @@ ZooKeeper.prototype.a_sync = function a_sync() {
   return this._native.a_sync.apply(this._native, arguments);
 }
 
+require('./zk_large')(ZooKeeper);
+require('./zk_walk')(ZooKeeper);
+require('./zk_snapshot')(ZooKeeper);
+require('./zk_deadline')(ZooKeeper);
+require('./zk_hedge')(ZooKeeper);
+require('./zk_shm')(ZooKeeper);
+require('./zk_ids')(ZooKeeper);
+require('./zk_probe')(ZooKeeper);
+
+exports.SnapshotWriter = require('./zk_snapshot').SnapshotWriter;
+
 //
 // ZK does not support ./file or /dir/../file
 // mkdirp(zookeeperConnection, '/a/deep/path/to/a/file', cb)
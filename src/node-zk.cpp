@@ -3,6 +3,11 @@
 #include <errno.h>
 #include <assert.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <node.h>
 #include <node_buffer.h>
 #include <node_object_wrap.h>
@@ -14,6 +19,8 @@ using namespace node;
 #include "nan.h"
 #include "zk_log.h"
 #include "buffer_compat.h"
+#include "zk_codec.h"
+#include "zk_shm.h"
 
 // @param c must be in [0-15]
 // @return '0'..'9','A'..'F'
@@ -66,11 +73,13 @@ namespace zk {
 DECLARE_STRING (on_closed);
 DECLARE_STRING (on_connected);
 DECLARE_STRING (on_connecting);
+DECLARE_STRING (on_readonly);
 DECLARE_STRING (on_event_created);
 DECLARE_STRING (on_event_deleted);
 DECLARE_STRING (on_event_changed);
 DECLARE_STRING (on_event_child);
 DECLARE_STRING (on_event_notwatching);
+DECLARE_STRING (on_event_batch);
 
 #define DECLARE_SYMBOL(ev)   DECLARE_STRING(ev)
 #define INITIALIZE_SYMBOL(ev) INITIALIZE_STRING(ev, #ev)
@@ -80,6 +89,35 @@ DECLARE_SYMBOL (PRIVATE_PROP_HANDBACK);
 
 #define ZOOKEEPER_PASSWORD_BYTE_COUNT 16
 
+// how data_completion returns a value when the read gave no node encoding
+#define DATA_AS_BUFFER -1
+#define DATA_AS_JSON -2
+#define ZOOKEEPER_MAX_PATH_LENGTH 1024
+
+// Read-only sessions arrived with the 3.5 client; the codes are defined here
+// so that the state and the error can be reported whichever client is linked.
+#ifndef ZOO_READONLY_STATE
+#define ZOO_READONLY_STATE 5
+#endif
+#ifndef ZNOTREADONLY
+#define ZNOTREADONLY -119
+#endif
+
+// Not a server or C client code: the rc of requests cancelled through a
+// token before they completed.
+#define ZCANCELLED -150
+
+// zerror() with a clearer message for the codes the linked client may not know
+static const char *zk_error (int rc) {
+    if (rc == ZNOTREADONLY) {
+        return "session is read-only: writes need a server with quorum";
+    }
+    if (rc == ZCANCELLED) {
+        return "request cancelled";
+    }
+    return zerror(rc);
+}
+
 void delete_on_close(uv_handle_t* handle) {
     free(handle);
 }
@@ -90,6 +128,570 @@ struct completion_data {
     void *data;
 };
 
+// a data read; the encoding travels with the request, because the caller
+// may use one callback for several reads
+struct read_data {
+    Nan::Callback *cb;
+    int encoding;
+};
+
+// a_get_into keeps the target Buffer alive until the read completes
+struct into_data {
+    Nan::Callback *cb;
+    Nan::Persistent<Object> target;
+    size_t offset;
+};
+
+// everything a zoo_amulti call needs kept alive until its completion
+struct multi_data {
+    Nan::Callback *cb;
+    int count;
+    zoo_op_t *ops;
+    zoo_op_result_t *results;
+    struct Stat *stats;
+    char **allocs;      // paths, payloads and path buffers to free
+    int alloc_count;
+    struct ACL_vector **acls;
+};
+
+// a compressed read being inflated on the thread pool
+struct inflate_work {
+    uv_work_t req;
+    Nan::Callback *cb;
+    int encoding;
+    int rc;
+    struct Stat stat;
+    bool has_stat;
+    char *in;
+    int in_len;
+    char *out;
+    int out_len;
+    bool ok;
+};
+
+class ZooKeeper;
+
+// a watch event waiting in the coalescing queue; cb is the aw_* watcher for
+// events from watcher_fn and NULL for events of the handle itself
+struct queued_event {
+    int type;
+    int state;
+    char *path;
+    Nan::Callback *cb;
+    unsigned hash;
+    struct queued_event *next;         // delivery order
+    struct queued_event *bucket_next;  // dedupe chain
+};
+
+#define EVENT_BUCKETS 4096
+
+// a request with a deadline or a cancellation token. The entry outlives an
+// expired deadline: the C client completes the request later anyway, and
+// that late completion is swallowed when it finds rc already set.
+struct op_deadline {
+    Nan::Callback *cb;
+    int64_t at;                        // loop time in ms, 0 for no deadline
+    uint32_t token;                    // cancellation token, 0 for none
+    int rc;                            // ZOK until the request is answered
+    bool due;                          // on a list being fired right now
+    struct op_deadline *slot_next;     // wheel slot, or the list being fired
+    struct op_deadline *bucket_next;   // lookup by callback
+};
+
+#define DEADLINE_SLOTS 256
+#define DEADLINE_TICK 10               // ms per wheel slot
+#define DEADLINE_BUCKETS 1024
+
+// a subtree walk: a breadth-first queue of znodes still to visit, read with
+// at most `window` requests in flight
+struct walk_node {
+    char *path;
+    int depth;
+    struct walk_node *next;
+};
+
+struct subtree_walk {
+    ZooKeeper *zk;
+    int32_t id;
+    Nan::Callback *cb;
+    struct walk_node *head;
+    struct walk_node *tail;
+    int max_depth;      // -1 for no limit
+    bool with_data;
+    int window;
+    int in_flight;
+    bool paused;
+    bool cancelled;
+    char **exclude;     // subtrees not to descend into
+    int exclude_count;
+    uint64_t visited;
+    struct subtree_walk *next;
+};
+
+// context of one walk request
+struct walk_req {
+    struct subtree_walk *w;
+    char *path;
+    int depth;
+};
+
+// a watch_children subscription; the last child set is kept sorted, with
+// the pointer array and the names in one allocation
+struct child_watch {
+    ZooKeeper *zk;
+    char *path;
+    Nan::Callback *cb;
+    char **children;
+    int count;
+    bool full;          // deliver the whole set instead of a diff
+    bool in_flight;
+    bool armed;         // the C client holds a watch pointing at this
+    bool cancelled;
+    bool in_callback;   // the JS callback is running; w must stay linked
+    struct child_watch *next;
+};
+
+// a linearizable read waiting for the next coalesced sync
+struct sync_read {
+    char *path;
+    bool watch;
+    struct read_data *read;
+    struct sync_read *next;
+};
+
+static struct ACL_vector *createAclVector (Handle<Array> arr) {
+    Nan::HandleScope scope;
+
+    struct ACL_vector *aclv = (struct ACL_vector *) malloc(sizeof(struct ACL_vector));
+    aclv->count = arr->Length();
+    aclv->data = (struct ACL *) calloc(aclv->count, sizeof(struct ACL));
+
+    for (int i = 0, l = aclv->count; i < l; i++) {
+        Local<Object> obj = Local<Object>::Cast(arr->Get(i));
+
+        Nan::Utf8String _scheme (obj->Get(LOCAL_STRING("scheme"))->ToString());
+        Nan::Utf8String _auth (obj->Get(LOCAL_STRING("auth"))->ToString());
+        uint32_t _perms = obj->Get(LOCAL_STRING("perms"))->Uint32Value();
+
+        struct Id id;
+        struct ACL *acl = &aclv->data[i];
+
+        id.scheme = strdup(*_scheme);
+        id.id = strdup(*_auth);
+
+        acl->perms = _perms;
+        acl->id = id;
+    }
+
+
+    return aclv;
+}
+
+// An ACL list compiled once from JS, e.g. ZooKeeper.acl([{ perms, scheme, auth }]),
+// and passed to any number of a_create, a_set_acl and a_multi calls without
+// being converted again.
+class AclHandle: public Nan::ObjectWrap {
+public:
+    static void Initialize (v8::Handle<v8::Object> target) {
+        Nan::HandleScope scope;
+
+        Local<FunctionTemplate> t = Nan::New<FunctionTemplate>(New);
+        t->SetClassName(LOCAL_STRING("Acl"));
+        t->InstanceTemplate()->SetInternalFieldCount(1);
+        Nan::SetAccessor(t->InstanceTemplate(), LOCAL_STRING("length"), LengthPropertyGetter, 0, Local<Value>(), PROHIBITS_OVERWRITING, ReadOnly);
+        acl_template.Reset(t);
+
+        target->Set(LOCAL_STRING("Acl"), t->GetFunction());
+    }
+
+    static void New(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        THROW_IF_NOT (info.IsConstructCall(), "Acl must be called with new");
+        THROW_IF_NOT (info.Length() >= 1 && info[0]->IsArray(), "Acl: expected an array of { perms, scheme, auth }");
+        AclHandle *h = new AclHandle(createAclVector(Local<Array>::Cast(info[0])));
+        h->Wrap(info.This());
+        RETURN_THIS(info);
+    }
+
+    static bool HasInstance (Local<Value> v) {
+        return v->IsObject() && Nan::New(acl_template)->HasInstance(v);
+    }
+
+    static const struct ACL_vector *Vector (Local<Value> v) {
+        return ObjectWrap::Unwrap<AclHandle>(v->ToObject())->aclv;
+    }
+
+    static NAN_PROPERTY_GETTER(LengthPropertyGetter) {
+        AclHandle *h = ObjectWrap::Unwrap<AclHandle>(info.This());
+        RETURN_VALUE(info, Nan::New<Integer>(h->aclv->count));
+    }
+
+    virtual ~AclHandle() {
+        deallocate_ACL_vector(aclv);
+        free(aclv);
+    }
+
+private:
+    explicit AclHandle (struct ACL_vector *v) : aclv(v) {}
+
+    static Nan::Persistent<FunctionTemplate> acl_template;
+    struct ACL_vector *aclv;
+};
+
+Nan::Persistent<FunctionTemplate> AclHandle::acl_template;
+
+// An ACL argument: an Acl handle (used as is), an array (compiled for this
+// call only) or undefined (ZOO_OPEN_ACL_UNSAFE). The C client serializes the
+// request before the zoo_a* call returns, so the vector only has to outlive
+// that call.
+class AclArg {
+public:
+    explicit AclArg (Local<Value> v) : owned(NULL) {
+        if (AclHandle::HasInstance(v)) {
+            vector = AclHandle::Vector(v);
+        } else if (v->IsArray()) {
+            vector = owned = createAclVector(Local<Array>::Cast(v));
+        } else {
+            vector = &ZOO_OPEN_ACL_UNSAFE;
+        }
+    }
+    ~AclArg () {
+        if (owned) {
+            deallocate_ACL_vector(owned);
+            free(owned);
+        }
+    }
+    const struct ACL_vector *vector;
+private:
+    struct ACL_vector *owned;
+};
+
+// Interned paths: the V8 strings of live Path handles, looked up by path so
+// that events for those paths reuse the string instead of building a new
+// one each time.
+struct interned_path {
+    char *path;
+    int len;
+    unsigned hash;
+    int refs;                          // Path handles holding the entry
+    Nan::Persistent<String> str;
+    struct interned_path *next;
+};
+
+#define INTERN_BUCKETS 1024
+
+static struct interned_path *interned_paths[INTERN_BUCKETS];
+
+static unsigned pathHash (const char *path) {
+    unsigned h = 2166136261u;
+    for (const char *p = path; *p; p++) {
+        h = (h ^ (unsigned char) *p) * 16777619u;
+    }
+    return h;
+}
+
+static struct interned_path *internPath (const char *path, int len) {
+    unsigned h = pathHash(path);
+    struct interned_path *e;
+    for (e = interned_paths[h % INTERN_BUCKETS]; e; e = e->next) {
+        if (e->hash == h && strcmp(e->path, path) == 0) {
+            e->refs++;
+            return e;
+        }
+    }
+    e = new interned_path();
+    e->path = strdup(path);
+    e->len = len;
+    e->hash = h;
+    e->refs = 1;
+    e->str.Reset(LOCAL_STRING(path));
+    e->next = interned_paths[h % INTERN_BUCKETS];
+    interned_paths[h % INTERN_BUCKETS] = e;
+    return e;
+}
+
+static void releasePath (struct interned_path *e) {
+    if (--e->refs > 0) {
+        return;
+    }
+    struct interned_path **p = &interned_paths[e->hash % INTERN_BUCKETS];
+    while (*p != e) {
+        p = &(*p)->next;
+    }
+    *p = e->next;
+    e->str.Reset();
+    free(e->path);
+    delete e;
+}
+
+// The string for a path in an event: the interned one if a Path handle
+// exists for it, a new one otherwise.
+static Local<String> pathString (const char *path) {
+    unsigned h = pathHash(path);
+    for (struct interned_path *e = interned_paths[h % INTERN_BUCKETS]; e; e = e->next) {
+        if (e->hash == h && strcmp(e->path, path) == 0) {
+            return Nan::New(e->str);
+        }
+    }
+    return LOCAL_STRING(path);
+}
+
+// Returns what is wrong with a znode path, or NULL if it is valid. A
+// trailing / is allowed: it is the prefix of a ZOO_SEQUENCE create, and
+// the server refuses it for everything else.
+static const char *checkPath (const char *path, int len) {
+    if (len == 0 || path[0] != '/') {
+        return "path must start with /";
+    }
+    if (len >= ZOOKEEPER_MAX_PATH_LENGTH) {
+        return "path is too long";
+    }
+    if ((int) strlen(path) != len) {
+        return "path must not contain NUL characters";
+    }
+    for (const char *p = path; *p; p++) {
+        if (p[0] != '/') {
+            continue;
+        }
+        if (p[1] == '/') {
+            return "path must not contain empty node names";
+        }
+        if (p[1] == '.' && (p[2] == '/' || p[2] == 0 || (p[2] == '.' && (p[3] == '/' || p[3] == 0)))) {
+            return "path must not contain . or .. node names";
+        }
+    }
+    return NULL;
+}
+
+// A prepared path: the validated UTF-8 bytes of a znode path and its
+// interned string, for paths that are used over and over. Every a_* and
+// aw_* method takes one wherever it takes a path string.
+class PathHandle: public Nan::ObjectWrap {
+public:
+    static void Initialize (v8::Handle<v8::Object> target) {
+        Nan::HandleScope scope;
+
+        Local<FunctionTemplate> t = Nan::New<FunctionTemplate>(New);
+        t->SetClassName(LOCAL_STRING("Path"));
+        t->InstanceTemplate()->SetInternalFieldCount(1);
+        Nan::SetPrototypeMethod(t, "toString", ToString);
+        Nan::SetAccessor(t->InstanceTemplate(), LOCAL_STRING("path"), PathPropertyGetter, 0, Local<Value>(), PROHIBITS_OVERWRITING, ReadOnly);
+        path_template.Reset(t);
+
+        target->Set(LOCAL_STRING("Path"), t->GetFunction());
+    }
+
+    static void New(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        THROW_IF_NOT (info.IsConstructCall(), "Path must be called with new");
+        THROW_IF_NOT (info.Length() >= 1 && info[0]->IsString(), "Path: expected a path string");
+        Nan::Utf8String _path (info[0]->ToString());
+        const char *problem = checkPath(*_path, _path.length());
+        THROW_IF_NOT (problem == NULL, problem);
+        PathHandle *h = new PathHandle(internPath(*_path, _path.length()));
+        h->Wrap(info.This());
+        RETURN_THIS(info);
+    }
+
+    static bool HasInstance (Local<Value> v) {
+        return v->IsObject() && Nan::New(path_template)->HasInstance(v);
+    }
+
+    static const struct interned_path *Entry (Local<Value> v) {
+        return ObjectWrap::Unwrap<PathHandle>(v->ToObject())->entry;
+    }
+
+    static void ToString(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        PathHandle *h = ObjectWrap::Unwrap<PathHandle>(info.This());
+        RETURN_VALUE(info, Nan::New(h->entry->str));
+    }
+
+    static NAN_PROPERTY_GETTER(PathPropertyGetter) {
+        PathHandle *h = ObjectWrap::Unwrap<PathHandle>(info.This());
+        RETURN_VALUE(info, Nan::New(h->entry->str));
+    }
+
+    virtual ~PathHandle() {
+        releasePath(entry);
+    }
+
+private:
+    explicit PathHandle (struct interned_path *e) : entry(e) {}
+
+    static Nan::Persistent<FunctionTemplate> path_template;
+    struct interned_path *entry;
+};
+
+Nan::Persistent<FunctionTemplate> PathHandle::path_template;
+
+// A path argument: a Path handle (its bytes are used as they are) or
+// anything else, converted to a UTF-8 string for this call.
+class PathArg {
+public:
+    explicit PathArg (Local<Value> v) : str(NULL) {
+        if (PathHandle::HasInstance(v)) {
+            const struct interned_path *e = PathHandle::Entry(v);
+            path = e->path;
+            len = e->len;
+        } else {
+            str = new Nan::Utf8String(v->ToString());
+            path = **str;
+            len = str->length();
+        }
+    }
+    ~PathArg () {
+        delete str;
+    }
+    const char *operator* () const {
+        return path;
+    }
+    int length () const {
+        return len;
+    }
+private:
+    Nan::Utf8String *str;
+    const char *path;
+    int len;
+};
+
+// A shared config file (see zk_shm.h), opened by the one process that
+// publishes a subtree into it, or read-only by any process on the host.
+// Reading needs no ZooKeeper session.
+class SharedConfig: public Nan::ObjectWrap {
+public:
+    static void Initialize (v8::Handle<v8::Object> target) {
+        Nan::HandleScope scope;
+
+        Local<FunctionTemplate> t = Nan::New<FunctionTemplate>(New);
+        t->SetClassName(LOCAL_STRING("SharedConfig"));
+        t->InstanceTemplate()->SetInternalFieldCount(1);
+        Nan::SetPrototypeMethod(t, "publish", Publish);
+        Nan::SetPrototypeMethod(t, "get", Get);
+        Nan::SetPrototypeMethod(t, "close", Close);
+        Nan::SetAccessor(t->InstanceTemplate(), LOCAL_STRING("generation"), GenerationPropertyGetter, 0, Local<Value>(), PROHIBITS_OVERWRITING, ReadOnly);
+
+        target->Set(LOCAL_STRING("SharedConfig"), t->GetFunction());
+    }
+
+    // new SharedConfig(file, writable)
+    static void New(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        THROW_IF_NOT (info.IsConstructCall(), "SharedConfig must be called with new");
+        THROW_IF_NOT (info.Length() >= 1 && info[0]->IsString(), "SharedConfig: expected a file name");
+        Nan::Utf8String _file (info[0]->ToString());
+        bool writable = info.Length() >= 2 && info[1]->BooleanValue();
+        SharedConfig *sc = new SharedConfig();
+        if (zk_shm_open(&sc->shm, *_file, writable) < 0) {
+            int err = errno;
+            delete sc;
+            if (writable && err == EWOULDBLOCK) {
+                return Nan::ThrowException(Nan::ErrnoException(err, "flock", "shared config has a publisher already", *_file));
+            }
+            return Nan::ThrowException(Nan::ErrnoException(err, "open", "cannot open shared config", *_file));
+        }
+        sc->Wrap(info.This());
+        RETURN_THIS(info);
+    }
+
+    // publish([{ path, data, version, mzxid }]): replaces the whole snapshot
+    static void Publish(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        SharedConfig *sc = ObjectWrap::Unwrap<SharedConfig>(info.This());
+        THROW_IF_NOT (sc->shm.base != NULL, "publish: shared config is closed");
+        THROW_IF_NOT (sc->shm.writable, "publish: shared config is read-only");
+        THROW_IF_NOT (info.Length() >= 1 && info[0]->IsArray(), "publish: expected an array of nodes");
+
+        Local<Array> arr = Local<Array>::Cast(info[0]);
+        uint32_t count = arr->Length();
+        struct zk_shm_record *records = (struct zk_shm_record *) calloc(count ? count : 1, sizeof(struct zk_shm_record));
+        PathArg **paths = (PathArg **) calloc(count ? count : 1, sizeof(PathArg *));
+        const char *problem = NULL;
+        uint32_t i;
+
+        for (i = 0; i < count && !problem; i++) {
+            Local<Value> v = arr->Get(i);
+            if (!v->IsObject()) {
+                problem = "publish: every node must be an object";
+                break;
+            }
+            Local<Object> o = v->ToObject();
+            Local<Value> data = o->Get(LOCAL_STRING("data"));
+            paths[i] = new PathArg(o->Get(LOCAL_STRING("path")));
+            records[i].path = **paths[i];
+            records[i].path_len = paths[i]->length();
+            if (Buffer::HasInstance(data)) {
+                records[i].value = BufferData(data->ToObject());
+                records[i].value_len = BufferLength(data->ToObject());
+            } else if (!data->IsUndefined() && !data->IsNull()) {
+                problem = "publish: node data must be a Buffer";
+            }
+            records[i].version = o->Get(LOCAL_STRING("version"))->Int32Value();
+            records[i].mzxid = (uint64_t) o->Get(LOCAL_STRING("mzxid"))->NumberValue();
+        }
+
+        int rc = problem ? 0 : zk_shm_publish(&sc->shm, records, count);
+        int err = errno;
+        for (i = 0; i < count; i++) {
+            delete paths[i];
+        }
+        free(paths);
+        free(records);
+        THROW_IF_NOT (problem == NULL, problem);
+        if (rc < 0) {
+            return Nan::ThrowException(Nan::ErrnoException(err, "ftruncate", "cannot grow shared config", NULL));
+        }
+        RETURN_VALUE(info, Nan::New<Number>((double) zk_shm_generation(&sc->shm)));
+    }
+
+    // get(path): a Buffer with the value, or null if path is not published
+    static void Get(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        SharedConfig *sc = ObjectWrap::Unwrap<SharedConfig>(info.This());
+        THROW_IF_NOT (sc->shm.base != NULL, "get: shared config is closed");
+        THROW_IF_NOT (info.Length() >= 1, "get: expected a path");
+        PathArg _path (info[0]);
+        char *value = NULL;
+        uint32_t value_len = 0;
+        int found = zk_shm_get(&sc->shm, *_path, _path.length(), &value, &value_len, NULL);
+        if (found < 0 && errno == EAGAIN) {
+            return Nan::ThrowException(Nan::ErrnoException(errno, "get", "shared config kept changing, try again", NULL));
+        }
+        if (found < 0) {
+            return Nan::ThrowException(Nan::ErrnoException(errno, "mmap", "cannot map shared config", NULL));
+        }
+        if (found == 0) {
+            RETURN_VALUE(info, Nan::Null());
+            return;
+        }
+        Local<Object> buf = BufferNew(value, value_len).ToLocalChecked();
+        free(value);
+        RETURN_VALUE(info, buf);
+    }
+
+    static void Close(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        SharedConfig *sc = ObjectWrap::Unwrap<SharedConfig>(info.This());
+        zk_shm_close(&sc->shm);
+    }
+
+    static NAN_PROPERTY_GETTER(GenerationPropertyGetter) {
+        SharedConfig *sc = ObjectWrap::Unwrap<SharedConfig>(info.This());
+        if (sc->shm.base == NULL) {
+            RETURN_VALUE(info, Nan::New<Number>(0));
+            return;
+        }
+        RETURN_VALUE(info, Nan::New<Number>((double) zk_shm_generation(&sc->shm)));
+    }
+
+    virtual ~SharedConfig() {
+        zk_shm_close(&shm);
+    }
+
+private:
+    SharedConfig () {
+        shm.fd = -1;
+        shm.writable = 0;
+        shm.base = NULL;
+        shm.size = 0;
+    }
+
+    zk_shm_t shm;
+};
+
 class ZooKeeper: public Nan::ObjectWrap {
 public:
     static void Initialize (v8::Handle<v8::Object> target) {
@@ -117,6 +719,18 @@ public:
         Nan::SetPrototypeMethod(constructor_template,  "a_set_acl",  ASetAcl);
         Nan::SetPrototypeMethod(constructor_template,  "add_auth",  AddAuth);
         Nan::SetPrototypeMethod(constructor_template,  "a_sync",  ASync);
+        Nan::SetPrototypeMethod(constructor_template,  "a_get_linearizable",  AGetLinearizable);
+        Nan::SetPrototypeMethod(constructor_template,  "a_get_into",  AGetInto);
+        Nan::SetPrototypeMethod(constructor_template,  "a_multi",  AMulti);
+        Nan::SetPrototypeMethod(constructor_template,  "drop_connection",  DropConnection);
+        Nan::SetPrototypeMethod(constructor_template,  "watch_children",  WatchChildren);
+        Nan::SetPrototypeMethod(constructor_template,  "unwatch_children",  UnwatchChildren);
+        Nan::SetPrototypeMethod(constructor_template,  "walk",  Walk);
+        Nan::SetPrototypeMethod(constructor_template,  "walk_pause",  WalkPause);
+        Nan::SetPrototypeMethod(constructor_template,  "walk_resume",  WalkResume);
+        Nan::SetPrototypeMethod(constructor_template,  "walk_cancel",  WalkCancel);
+        Nan::SetPrototypeMethod(constructor_template,  "set_next_op",  SetNextOp);
+        Nan::SetPrototypeMethod(constructor_template,  "cancel",  CancelToken);
 
         //what's the advantage of using constructor_template->PrototypeTemplate()->SetAccessor ?
         Nan::SetAccessor(constructor_template->InstanceTemplate(), LOCAL_STRING("state"), StatePropertyGetter, 0, Local<Value>(), PROHIBITS_OVERWRITING, ReadOnly);
@@ -124,6 +738,12 @@ public:
         Nan::SetAccessor(constructor_template->InstanceTemplate(), LOCAL_STRING("client_password"), ClientPasswordPropertyGetter, 0, Local<Value>(), PROHIBITS_OVERWRITING, ReadOnly);
         Nan::SetAccessor(constructor_template->InstanceTemplate(), LOCAL_STRING("timeout"), SessionTimeoutPropertyGetter, 0, Local<Value>(), PROHIBITS_OVERWRITING, ReadOnly);
         Nan::SetAccessor(constructor_template->InstanceTemplate(), LOCAL_STRING("is_unrecoverable"), IsUnrecoverablePropertyGetter, 0, Local<Value>(), PROHIBITS_OVERWRITING, ReadOnly);
+        Nan::SetAccessor(constructor_template->InstanceTemplate(), LOCAL_STRING("sync_stats"), SyncStatsPropertyGetter, 0, Local<Value>(), PROHIBITS_OVERWRITING, ReadOnly);
+        Nan::SetAccessor(constructor_template->InstanceTemplate(), LOCAL_STRING("compression_stats"), CompressionStatsPropertyGetter, 0, Local<Value>(), PROHIBITS_OVERWRITING, ReadOnly);
+        Nan::SetAccessor(constructor_template->InstanceTemplate(), LOCAL_STRING("server"), ServerPropertyGetter, 0, Local<Value>(), PROHIBITS_OVERWRITING, ReadOnly);
+        Nan::SetAccessor(constructor_template->InstanceTemplate(), LOCAL_STRING("connection_stats"), ConnectionStatsPropertyGetter, 0, Local<Value>(), PROHIBITS_OVERWRITING, ReadOnly);
+        Nan::SetAccessor(constructor_template->InstanceTemplate(), LOCAL_STRING("event_stats"), EventStatsPropertyGetter, 0, Local<Value>(), PROHIBITS_OVERWRITING, ReadOnly);
+        Nan::SetAccessor(constructor_template->InstanceTemplate(), LOCAL_STRING("deadline_stats"), DeadlineStatsPropertyGetter, 0, Local<Value>(), PROHIBITS_OVERWRITING, ReadOnly);
 
 
         Local<Function> constructor = constructor_template->GetFunction();
@@ -187,6 +807,8 @@ public:
         NODE_DEFINE_CONSTANT(constructor, ZOO_LOG_LEVEL_INFO);
         NODE_DEFINE_CONSTANT(constructor, ZOO_LOG_LEVEL_DEBUG);
 
+        NODE_DEFINE_CONSTANT(constructor, ZOO_READONLY_STATE);
+
         NODE_DEFINE_CONSTANT(constructor, ZOO_EXPIRED_SESSION_STATE);
         NODE_DEFINE_CONSTANT(constructor, ZOO_AUTH_FAILED_STATE);
         NODE_DEFINE_CONSTANT(constructor, ZOO_CONNECTING_STATE);
@@ -230,6 +852,8 @@ public:
         NODE_DEFINE_CONSTANT(constructor, ZCLOSING);
         NODE_DEFINE_CONSTANT(constructor, ZNOTHING);
         NODE_DEFINE_CONSTANT(constructor, ZSESSIONMOVED);
+        NODE_DEFINE_CONSTANT(constructor, ZNOTREADONLY);
+        NODE_DEFINE_CONSTANT(constructor, ZCANCELLED);
 
 
         target->Set(LOCAL_STRING("ZooKeeper"), constructor);
@@ -250,6 +874,23 @@ public:
 
         last_activity = uv_now(uv_default_loop());
 
+        // after a disconnect, hold off the C client's next connection attempt
+        // (made inside zookeeper_interest) until the jittered backoff expires.
+        // The 3.4 client reports state 0, not ZOO_CONNECTING_STATE, between
+        // dropping a connection and starting the next one.
+        if (reconnect_at > last_activity && !isAttached()) {
+            if (zk_io && uv_is_active((uv_handle_t*) zk_io)) {
+                uv_poll_stop(zk_io);
+            }
+            int64_t wait = reconnect_at - last_activity;
+            tv.tv_sec = wait / 1000;
+            tv.tv_usec = (wait % 1000) * 1000;
+            LOG_DEBUG(("yield: delaying reconnect by %d ms", (int) wait));
+            wait = timerDelay(wait);
+            uv_timer_start(&zk_timer, &zk_timer_cb, wait, wait);
+            return;
+        }
+
         int oldFd = fd;
         int rc = zookeeper_interest(zhandle, &fd, &interest, &tv);
 
@@ -302,6 +943,7 @@ public:
         LOG_DEBUG(("yield: starting poll for %lp from thread %lp", this));
         uv_poll_start(zk_io, events, &zk_io_cb);
 
+        delay = timerDelay(delay);
         uv_timer_start(&zk_timer, &zk_timer_cb, delay, delay);
     }
 
@@ -334,6 +976,12 @@ public:
 
         ZooKeeper *zk = static_cast<ZooKeeper*>(w->data);
         int64_t now = uv_now(uv_default_loop());
+        if (zk->deadlines_timed > 0) {
+            zk->expireDeadlines(now);
+            if (zk->is_closed) {
+                return;
+            }
+        }
         int64_t timeout = zk->last_activity + zk->tv.tv_sec * 1000 + zk->tv.tv_usec / 1000.;
 
         // if last_activity + tv.tv_sec is older than now, we did time out
@@ -345,7 +993,7 @@ public:
             // callback was invoked, but there was some activity, re-arm
             // the watcher to fire in last_activity + 60, which is
             // guaranteed to be in the future, so "again" is positive:
-            int64_t delay = timeout - now + 1;
+            int64_t delay = zk->timerDelay(timeout - now + 1);
             uv_timer_start(w, &zk_timer_cb, delay, delay);
 
             LOG_DEBUG(("delaying ping timer by %lu", delay));
@@ -362,7 +1010,19 @@ public:
         }
       
         myid = *client_id;
-        zhandle = zookeeper_init(hostPort, main_watcher, session_timeout, &myid, this, 0);
+        // the C client shuffles the host list once, inside zookeeper_init,
+        // so setting the global flag right before the call makes it per handle
+        zoo_deterministic_conn_order(deterministic_order);
+        int flags = 0;
+        if (readonly) {
+#ifdef ZOO_READONLY
+            flags |= ZOO_READONLY;
+#else
+            LOG_WARN(("read-only sessions need a 3.5 or later client, opening a regular session"));
+#endif
+        }
+        zhandle = zookeeper_init(hostPort, main_watcher, session_timeout, &myid, this, flags);
+        connect_attempts++;
         if (!zhandle) {
             LOG_ERROR(("zookeeper_init returned 0!"));
             return false;
@@ -387,7 +1047,6 @@ public:
         zoo_set_debug_level(static_cast<ZooLogLevel>(debug_level));
 
         bool order = arg->Get(LOCAL_STRING("host_order_deterministic"))->ToBoolean()->BooleanValue();
-        zoo_deterministic_conn_order(order); // enable deterministic order
 
         Nan::Utf8String _hostPort (arg->Get(LOCAL_STRING("connect"))->ToString());
         int32_t session_timeout = arg->Get(LOCAL_STRING("timeout"))->Int32Value();
@@ -414,6 +1073,27 @@ public:
         ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());
         assert(zk);
 
+        zk->configureCompression(arg->Get(LOCAL_STRING("compression")));
+        zk->configureCoalescing(arg->Get(LOCAL_STRING("event_coalescing")));
+        zk->deterministic_order = order;
+        zk->readonly = arg->Get(LOCAL_STRING("readonly"))->BooleanValue();
+        zk->op_timeout = arg->Get(LOCAL_STRING("op_timeout"))->Uint32Value();
+
+        // reconnect_backoff: { base: ms, max: ms }
+        Local<Value> v8v_backoff = arg->Get(LOCAL_STRING("reconnect_backoff"));
+        zk->backoff_base = zk->backoff_max = 0;
+        if (v8v_backoff->IsObject()) {
+            Local<Object> backoff = v8v_backoff->ToObject();
+            zk->backoff_base = backoff->Get(LOCAL_STRING("base"))->Uint32Value();
+            zk->backoff_max = backoff->Get(LOCAL_STRING("max"))->Uint32Value();
+            if (zk->backoff_base == 0) {
+                zk->backoff_base = 100;
+            }
+            if (zk->backoff_max == 0) {
+                zk->backoff_max = 5000;
+            }
+        }
+
         if (!zk->realInit(*_hostPort, session_timeout, &local_client)) {
             RETURN_VALUE(info, Nan::ErrnoException(errno, "zookeeper_init", "failed to init", __FILE__));
         } else {
@@ -421,57 +1101,244 @@ public:
         }
     }
 
-    static void main_watcher (zhandle_t *zzh, int type, int state, const char *path, void* context) {
-        Nan::HandleScope scope;
-        LOG_DEBUG(("main watcher event: type=%d, state=%d, path=%s", type, state, (path ? path: "null")));
-        ZooKeeper *zk = static_cast<ZooKeeper *>(context);
-
-        if (type == ZOO_SESSION_EVENT) {
-            if (state == ZOO_CONNECTED_STATE) {
-                zk->myid = *(zoo_client_id(zzh));
-                zk->DoEmitPath(Nan::New(on_connected), path);
-            } else if (state == ZOO_CONNECTING_STATE) {
-                zk->DoEmitPath (Nan::New(on_connecting), path);
-            } else if (state == ZOO_AUTH_FAILED_STATE) {
-                LOG_ERROR(("Authentication failure. Shutting down...\n"));
-                zk->realClose(ZOO_AUTH_FAILED_STATE);
-            } else if (state == ZOO_EXPIRED_SESSION_STATE) {
-                LOG_ERROR(("Session expired. Shutting down...\n"));
-                zk->realClose(ZOO_EXPIRED_SESSION_STATE);
-            }
-        } else if (type == ZOO_CREATED_EVENT) {
-            zk->DoEmitPath(Nan::New(on_event_created), path);
-        } else if (type == ZOO_DELETED_EVENT) {
-            zk->DoEmitPath(Nan::New(on_event_deleted), path);
-        } else if (type == ZOO_CHANGED_EVENT) {
-            zk->DoEmitPath(Nan::New(on_event_changed), path);
-        } else if (type == ZOO_CHILD_EVENT) {
-            zk->DoEmitPath(Nan::New(on_event_child), path);
-        } else if (type == ZOO_NOTWATCHING_EVENT) {
-            zk->DoEmitPath(Nan::New(on_event_notwatching), path);
-        } else {
-            LOG_WARN(("Unknonwn watcher event type %s",type));
+    // Full-jitter exponential backoff: the next attempt waits a random time
+    // in [0, min(max, base * 2^attempt)], capped at a third of the session
+    // timeout so a reconnect cannot by itself cause the session to expire.
+    void scheduleReconnect () {
+        if (backoff_base == 0) {
+            return;
+        }
+        int64_t ceiling = backoff_max;
+        int64_t step = (int64_t) backoff_base << (backoff_attempt < 16 ? backoff_attempt : 16);
+        if (step < ceiling) {
+            ceiling = step;
+        }
+        int timeout = zhandle ? zoo_recv_timeout(zhandle) : 0;
+        if (timeout > 0 && ceiling > timeout / 3) {
+            ceiling = timeout / 3;
         }
+        backoff_attempt++;
+        last_backoff = ceiling > 0 ? (int64_t) (random() % (ceiling + 1)) : 0;
+        reconnect_at = uv_now(uv_default_loop()) + last_backoff;
+        connect_attempts++;
+        LOG_DEBUG(("reconnect attempt %d in %d ms", backoff_attempt, (int) last_backoff));
     }
 
-    static Local<String> idAsString (int64_t id) {
-        Nan::EscapableHandleScope scope;
-        char idbuff [128] = {0};
-        sprintf(idbuff, "%llx", _LL_CAST_ id);
-        return scope.Escape(LOCAL_STRING(idbuff));
+    // Drops the TCP connection without closing the session. The C client
+    // fails over to the next host in its list and re-registers the watches
+    // there, so this moves the session to another server.
+    static void DropConnection(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());
+        assert(zk);
+        bool dropped = false;
+        if (zk->zhandle && zk->fd != -1 && zk->isAttached()) {
+            dropped = shutdown(zk->fd, SHUT_RDWR) == 0;
+        }
+        RETURN_VALUE(info, Nan::New<Boolean>(dropped));
     }
 
-    static void StringToId (v8::Local<v8::Value> s, int64_t *id) {
-        Nan::Utf8String a(s->ToString());
-        sscanf(*a, "%llx", _LLP_CAST_ id);
+    // connected to a server, either read-write or read-only
+    bool isAttached () {
+        int state = zoo_state(zhandle);
+        return state == ZOO_CONNECTED_STATE || state == ZOO_READONLY_STATE;
     }
 
-    static Local<String> PasswordToHexString (const char *p) {
+    // "ip:port" of the server the session is connected to, or null
+    Local<Value> connectedServer () {
         Nan::EscapableHandleScope scope;
-        char buff[ZOOKEEPER_PASSWORD_BYTE_COUNT * 2 + 1], *b = buff;
-        for (int i = 0; i < ZOOKEEPER_PASSWORD_BYTE_COUNT; ++i) {
-            ucharToHex((unsigned char *) (p + i), b);
-            b += 2;
+        struct sockaddr_storage addr;
+        socklen_t len = sizeof(addr);
+        if (!zhandle || !isAttached() ||
+                !zookeeper_get_connected_host(zhandle, (struct sockaddr *) &addr, &len)) {
+            return scope.Escape(Nan::Null());
+        }
+        char host[INET6_ADDRSTRLEN] = {0};
+        char buff[INET6_ADDRSTRLEN + 16];
+        int port;
+        if (addr.ss_family == AF_INET6) {
+            struct sockaddr_in6 *a = (struct sockaddr_in6 *) &addr;
+            inet_ntop(AF_INET6, &a->sin6_addr, host, sizeof(host));
+            port = ntohs(a->sin6_port);
+            snprintf(buff, sizeof(buff), "[%s]:%d", host, port);
+        } else {
+            struct sockaddr_in *a = (struct sockaddr_in *) &addr;
+            inet_ntop(AF_INET, &a->sin_addr, host, sizeof(host));
+            port = ntohs(a->sin_port);
+            snprintf(buff, sizeof(buff), "%s:%d", host, port);
+        }
+        return scope.Escape(LOCAL_STRING(buff));
+    }
+
+    // compression: true | false | { threshold, level, offload_bytes, paths }
+    void configureCompression (Local<Value> v) {
+        for (int i = 0; i < codec_path_count; i++) {
+            free(codec_paths[i]);
+        }
+        free(codec_paths);
+        codec_paths = NULL;
+        codec_path_count = 0;
+
+        codec_enabled = v->IsObject() || v->BooleanValue();
+        codec_threshold = 1024;
+        codec_level = Z_DEFAULT_COMPRESSION;
+        codec_offload = 64 * 1024;
+        if (!v->IsObject()) {
+            return;
+        }
+
+        Local<Object> o = v->ToObject();
+        Local<Value> threshold = o->Get(LOCAL_STRING("threshold"));
+        if (!threshold->IsUndefined()) {
+            codec_threshold = threshold->Int32Value();
+        }
+        Local<Value> level = o->Get(LOCAL_STRING("level"));
+        if (!level->IsUndefined()) {
+            codec_level = level->Int32Value();
+        }
+        Local<Value> offload = o->Get(LOCAL_STRING("offload_bytes"));
+        if (!offload->IsUndefined()) {
+            codec_offload = offload->Uint32Value();
+        }
+        Local<Value> paths = o->Get(LOCAL_STRING("paths"));
+        if (paths->IsArray()) {
+            Local<Array> arr = Local<Array>::Cast(paths);
+            codec_path_count = arr->Length();
+            codec_paths = (char **) calloc(codec_path_count > 0 ? codec_path_count : 1, sizeof(char *));
+            for (int i = 0; i < codec_path_count; i++) {
+                Nan::Utf8String prefix (arr->Get(i)->ToString());
+                codec_paths[i] = strdup(*prefix);
+            }
+        }
+    }
+
+    // Compresses a write payload when the codec policy selects it. On success
+    // *out is a malloc'd copy the caller sends (and frees) instead of data.
+    bool encodePayload (const char *path, const char *data, int len, char **out, int *out_len) {
+        if (!codec_enabled || len < codec_threshold) {
+            return false;
+        }
+        if (codec_path_count > 0) {
+            bool selected = false;
+            for (int i = 0; i < codec_path_count && !selected; i++) {
+                selected = strncmp(path, codec_paths[i], strlen(codec_paths[i])) == 0;
+            }
+            if (!selected) {
+                return false;
+            }
+        }
+        codec_writes++;
+        if (!zk_codec_compress(data, len, codec_level, out, out_len)) {
+            return false;
+        }
+        codec_compressed++;
+        codec_bytes_in += len;
+        codec_bytes_out += *out_len;
+        return true;
+    }
+
+    // A write payload taken from a Buffer, or from the string form of any
+    // other value, and run through the handle's codec.
+    class Payload {
+    public:
+        Payload (ZooKeeper *zk, const char *path, Local<Value> v) : str(NULL), encoded(NULL) {
+            if (Buffer::HasInstance(v)) {
+                Local<Object> o = v->ToObject();
+                data = BufferData(o);
+                len = BufferLength(o);
+            } else {
+                str = new Nan::Utf8String(v->ToString());
+                data = **str;
+                len = str->length();
+            }
+            int encoded_len;
+            if (zk->encodePayload(path, data, len, &encoded, &encoded_len)) {
+                data = encoded;
+                len = encoded_len;
+            }
+        }
+        ~Payload () {
+            delete str;
+            free(encoded);
+        }
+        const char *data;
+        int len;
+    private:
+        Nan::Utf8String *str;
+        char *encoded;
+    };
+
+    static void main_watcher (zhandle_t *zzh, int type, int state, const char *path, void* context) {
+        Nan::HandleScope scope;
+        LOG_DEBUG(("main watcher event: type=%d, state=%d, path=%s", type, state, (path ? path: "null")));
+        ZooKeeper *zk = static_cast<ZooKeeper *>(context);
+
+        zk->events_raw++;
+        if (type != ZOO_SESSION_EVENT && zk->coalesce_window > 0) {
+            zk->queueEvent(type, state, path, NULL);
+            return;
+        }
+        // session events are never coalesced, and must not overtake the
+        // events queued before them
+        zk->flushEvents(true);
+        zk->events_delivered++;
+
+        if (type == ZOO_SESSION_EVENT) {
+            if (state == ZOO_CONNECTED_STATE) {
+                zk->connects++;
+                zk->backoff_attempt = 0;
+                zk->myid = *(zoo_client_id(zzh));
+                zk->refreshChildWatches();
+                zk->DoEmitPath(Nan::New(on_connected), path);
+            } else if (state == ZOO_READONLY_STATE) {
+                // attached to a server that lost quorum: reads only, until
+                // the client finds a read-write server and emits 'connect'
+                zk->connects++;
+                zk->backoff_attempt = 0;
+                zk->DoEmitPath(Nan::New(on_readonly), path);
+            } else if (state == ZOO_CONNECTING_STATE) {
+                zk->disconnects++;
+                zk->scheduleReconnect();
+                zk->DoEmitPath (Nan::New(on_connecting), path);
+            } else if (state == ZOO_AUTH_FAILED_STATE) {
+                LOG_ERROR(("Authentication failure. Shutting down...\n"));
+                zk->realClose(ZOO_AUTH_FAILED_STATE);
+            } else if (state == ZOO_EXPIRED_SESSION_STATE) {
+                LOG_ERROR(("Session expired. Shutting down...\n"));
+                zk->realClose(ZOO_EXPIRED_SESSION_STATE);
+            }
+        } else if (type == ZOO_CREATED_EVENT) {
+            zk->DoEmitPath(Nan::New(on_event_created), path);
+        } else if (type == ZOO_DELETED_EVENT) {
+            zk->DoEmitPath(Nan::New(on_event_deleted), path);
+        } else if (type == ZOO_CHANGED_EVENT) {
+            zk->DoEmitPath(Nan::New(on_event_changed), path);
+        } else if (type == ZOO_CHILD_EVENT) {
+            zk->DoEmitPath(Nan::New(on_event_child), path);
+        } else if (type == ZOO_NOTWATCHING_EVENT) {
+            zk->DoEmitPath(Nan::New(on_event_notwatching), path);
+        } else {
+            LOG_WARN(("Unknonwn watcher event type %s",type));
+        }
+    }
+
+    static Local<String> idAsString (int64_t id) {
+        Nan::EscapableHandleScope scope;
+        char idbuff [128] = {0};
+        sprintf(idbuff, "%llx", _LL_CAST_ id);
+        return scope.Escape(LOCAL_STRING(idbuff));
+    }
+
+    static void StringToId (v8::Local<v8::Value> s, int64_t *id) {
+        Nan::Utf8String a(s->ToString());
+        sscanf(*a, "%llx", _LLP_CAST_ id);
+    }
+
+    static Local<String> PasswordToHexString (const char *p) {
+        Nan::EscapableHandleScope scope;
+        char buff[ZOOKEEPER_PASSWORD_BYTE_COUNT * 2 + 1], *b = buff;
+        for (int i = 0; i < ZOOKEEPER_PASSWORD_BYTE_COUNT; ++i) {
+            ucharToHex((unsigned char *) (p + i), b);
+            b += 2;
         }
         buff[ZOOKEEPER_PASSWORD_BYTE_COUNT * 2] = '\0';
         return scope.Escape(LOCAL_STRING(buff));
@@ -491,7 +1358,7 @@ public:
         Local<Value> str;
 
         if (path != 0) {
-            str = LOCAL_STRING(path);
+            str = pathString(path);
             LOG_DEBUG(("calling Emit(%s, path='%s')", *Nan::Utf8String(event_name), path));
         } else {
             str = Nan::Undefined();
@@ -531,10 +1398,12 @@ public:
         assert(zkk->handle() == zk_handle);        \
         Local<Value> argv[info]; \
         argv[0] = Nan::New<Int32>(rc);           \
-        argv[1] = LOCAL_STRING(zerror(rc))
+        argv[1] = LOCAL_STRING(zk_error(rc))
 
 #define CALLBACK_EPILOG() \
-        callback->Call(sizeof(argv)/sizeof(argv[0]), argv); \
+        if (!zkk->settleDeadline(callback)) { \
+            callback->Call(sizeof(argv)/sizeof(argv[0]), argv); \
+        } \
         delete callback
 
 #define WATCHER_CALLBACK_EPILOG() \
@@ -550,6 +1419,7 @@ public:
 
 #define METHOD_EPILOG(call) \
         int ret = (call); \
+        zk->armDeadline(ret == ZOK ? cb : NULL); \
         RETURN_VALUE(info, Nan::New<Int32>(ret))
 
 #define WATCHER_PROLOG(info) \
@@ -566,7 +1436,7 @@ public:
         Local<Value> argv[info]; \
         argv[0] = Nan::New<Integer>(type);   \
         argv[1] = Nan::New<Integer>(state);  \
-        argv[2] = LOCAL_STRING(path);                                 \
+        argv[2] = pathString(path);                                   \
         Local<Value> lv_hb = Nan::GetPrivate(callback->GetFunction(), Nan::New(PRIVATE_PROP_HANDBACK)).ToLocalChecked(); \
         argv[3] = Nan::Undefined();    \
         if (!lv_hb.IsEmpty()) argv[3] = lv_hb
@@ -595,30 +1465,35 @@ public:
         CALLBACK_EPILOG();
     }
 
+    // a_create(path, data, flags, [acl,] cb)
     static void ACreate(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        if (info.Length() >= 5) {
+            return ACreateAcl(info);
+        }
         A_METHOD_PROLOG(4);
 
-        Nan::Utf8String _path (info[0]->ToString());
+        PathArg _path (info[0]);
         uint32_t flags = info[2]->Uint32Value();
+        Payload _data (zk, *_path, info[1]);
 
-        if (Buffer::HasInstance(info[1])) { // buffer
-            Local<Object> _data = info[1]->ToObject();
-            METHOD_EPILOG(zoo_acreate(zk->zhandle, *_path, BufferData(_data), BufferLength(_data), &ZOO_OPEN_ACL_UNSAFE, flags, string_completion, cb));
-        } else {    // other
-            Nan::Utf8String _data (info[1]->ToString());
-            METHOD_EPILOG(zoo_acreate(zk->zhandle, *_path, *_data, _data.length(), &ZOO_OPEN_ACL_UNSAFE, flags, string_completion, cb));
-        }
+        METHOD_EPILOG(zoo_acreate(zk->zhandle, *_path, _data.data, _data.len, &ZOO_OPEN_ACL_UNSAFE, flags, string_completion, cb));
+    }
+
+    static void ACreateAcl(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        A_METHOD_PROLOG(5);
+
+        PathArg _path (info[0]);
+        uint32_t flags = info[2]->Uint32Value();
+        Payload _data (zk, *_path, info[1]);
+        AclArg _acl (info[3]);
+
+        METHOD_EPILOG(zoo_acreate(zk->zhandle, *_path, _data.data, _data.len, _acl.vector, flags, string_completion, cb));
     }
 
     static void void_completion (int rc, const void *data) {
         struct completion_data *d = (struct completion_data *) data;
         void *cb = (void *) d->cb;
 
-        if (d->type == ZOO_SETACL_OP) {
-            deallocate_ACL_vector((struct ACL_vector *)d->data);
-            free(d->data);
-        }
-
         CALLBACK_PROLOG(2);
         LOG_DEBUG(("rc=%d, rc_string=%s", rc, zerror(rc)));
         CALLBACK_EPILOG();
@@ -628,7 +1503,7 @@ public:
 
     static void ADelete(const Nan::FunctionCallbackInfo<v8::Value>& info) {
         A_METHOD_PROLOG(3);
-        Nan::Utf8String _path (info[0]->ToString());
+        PathArg _path (info[0]);
         uint32_t version = info[1]->Uint32Value();
 
         struct completion_data *data = (struct completion_data *) malloc(sizeof(struct completion_data));
@@ -669,7 +1544,7 @@ public:
     static void AExists(const Nan::FunctionCallbackInfo<v8::Value>& info) {
         A_METHOD_PROLOG(3);
 
-        Nan::Utf8String _path (info[0]->ToString());
+        PathArg _path (info[0]);
         bool watch = info[1]->ToBoolean()->BooleanValue();
 
         METHOD_EPILOG(zoo_aexists(zk->zhandle, *_path, watch, &stat_completion, cb));
@@ -677,19 +1552,45 @@ public:
 
     static void AWExists(const Nan::FunctionCallbackInfo<v8::Value>& info) {
         AW_METHOD_PROLOG(3);
-        Nan::Utf8String _path (info[0]->ToString());
+        PathArg _path (info[0]);
         METHOD_EPILOG(zoo_awexists(zk->zhandle, *_path, &watcher_fn, cbw, &stat_completion, cb));
     }
 
-    static void data_completion (int rc, const char *value, int value_len, const struct Stat *stat, const void *cb) {
+    static void data_completion (int rc, const char *value, int value_len, const struct Stat *stat, const void *data) {
+        struct read_data *d = (struct read_data *) data;
+        void *cb = (void *) d->cb;
+        int encoding = d->encoding;
+        free(d);
+
         CALLBACK_PROLOG(4);
 
         LOG_DEBUG(("rc=%d, rc_string=%s, value=%.*s", rc, zerror(rc), value_len, value));
 
         argv[2] = stat != 0 ? zkk->createStatObject (stat) : Nan::Null().As<Object>();
 
+        if (value != 0 && zkk->codec_enabled && zk_codec_is_encoded(value, value_len)) {
+            zkk->codec_reads++;
+            // large payloads are inflated on the thread pool; the callback
+            // then runs after the inflate finishes, possibly behind the
+            // callbacks of requests that were issued later
+            if (zk_codec_original_length(value) >= zkk->codec_offload) {
+                zkk->inflateAsync(rc, value, value_len, stat, callback, encoding);
+                return;
+            }
+            char *out;
+            int out_len;
+            if (zk_codec_decompress(value, value_len, &out, &out_len)) {
+                zkk->codec_inflated++;
+                argv[3] = dataValue(encoding, out, out_len, argv);
+                free(out);
+                CALLBACK_EPILOG();
+                return;
+            }
+            LOG_WARN(("payload has the compression header but does not inflate, returning it raw"));
+        }
+
         if (value != 0) {
-            argv[3] = BufferNew(value, value_len).ToLocalChecked();
+            argv[3] = dataValue(encoding, value, value_len, argv);
         } else {
             argv[3] = Nan::Null().As<Object>();
         }
@@ -697,10 +1598,115 @@ public:
         CALLBACK_EPILOG();
     }
 
+    // The encoding argument of a read: one of node's string encodings, or
+    // 'json' to parse the value. Anything else keeps the Buffer.
+    static int parseDataEncoding (Local<Value> v) {
+        if (!v->IsString()) {
+            return DATA_AS_BUFFER;
+        }
+        Nan::Utf8String _enc (v);
+        const char *e = *_enc;
+        if (strcasecmp(e, "utf8") == 0 || strcasecmp(e, "utf-8") == 0) {
+            return Nan::UTF8;
+        } else if (strcasecmp(e, "latin1") == 0 || strcasecmp(e, "binary") == 0) {
+            return Nan::BINARY;
+        } else if (strcasecmp(e, "hex") == 0) {
+            return Nan::HEX;
+        } else if (strcasecmp(e, "base64") == 0) {
+            return Nan::BASE64;
+        } else if (strcasecmp(e, "ascii") == 0) {
+            return Nan::ASCII;
+        } else if (strcasecmp(e, "ucs2") == 0 || strcasecmp(e, "utf16le") == 0) {
+            return Nan::UCS2;
+        } else if (strcasecmp(e, "json") == 0) {
+            return DATA_AS_JSON;
+        }
+        return DATA_AS_BUFFER;
+    }
+
+    // The completion context of a read with the encoding argument at
+    // info[index], if given, for data_completion.
+    static struct read_data *readData (Nan::Callback *cb, const Nan::FunctionCallbackInfo<v8::Value>& info, int index) {
+        struct read_data *d = (struct read_data *) malloc(sizeof(struct read_data));
+        d->cb = cb;
+        d->encoding = info.Length() > index ? parseDataEncoding(info[index]) : DATA_AS_BUFFER;
+        return d;
+    }
+
+    // A read's value in the encoding the read asked for, decoded straight
+    // from the client's bytes. A value that is not valid JSON comes back as
+    // a Buffer with rc ZMARSHALLINGERROR; an empty one is null.
+    static Local<Value> dataValue (int enc, const char *value, int value_len, Local<Value> *argv) {
+        if (enc == DATA_AS_BUFFER) {
+            return BufferNew(value, value_len).ToLocalChecked();
+        }
+        if (enc != DATA_AS_JSON) {
+            return Nan::Encode(value, value_len, (enum Nan::Encoding) enc);
+        }
+        if (value_len == 0) {
+            return Nan::Null();
+        }
+        Nan::TryCatch try_catch;
+        Nan::JSON json;
+        Nan::MaybeLocal<Value> parsed = json.Parse(Nan::New<String>(value, value_len).ToLocalChecked());
+        if (!parsed.IsEmpty()) {
+            return parsed.ToLocalChecked();
+        }
+        argv[0] = Nan::New<Int32>(ZMARSHALLINGERROR);
+        argv[1] = LOCAL_STRING("payload is not valid JSON");
+        return BufferNew(value, value_len).ToLocalChecked();
+    }
+
+    void inflateAsync (int rc, const char *value, int value_len, const struct Stat *stat, Nan::Callback *cb, int encoding) {
+        struct inflate_work *w = new inflate_work();
+        w->req.data = w;
+        w->cb = cb;
+        w->encoding = encoding;
+        w->rc = rc;
+        w->has_stat = stat != 0;
+        if (stat != 0) {
+            w->stat = *stat;
+        }
+        w->in = (char *) malloc(value_len);
+        memcpy(w->in, value, value_len);
+        w->in_len = value_len;
+        w->out = NULL;
+        w->out_len = 0;
+        w->ok = false;
+        uv_queue_work(uv_default_loop(), &w->req, inflate_work_cb, inflate_after_cb);
+    }
+
+    static void inflate_work_cb (uv_work_t *req) {
+        struct inflate_work *w = (struct inflate_work *) req->data;
+        w->ok = zk_codec_decompress(w->in, w->in_len, &w->out, &w->out_len);
+    }
+
+    static void inflate_after_cb (uv_work_t *req, int status) {
+        struct inflate_work *w = (struct inflate_work *) req->data;
+        void *cb = (void *) w->cb;
+        int rc = w->rc;
+
+        CALLBACK_PROLOG(4);
+
+        argv[2] = w->has_stat ? zkk->createStatObject (&w->stat) : Nan::Null().As<Object>();
+        if (w->ok) {
+            zkk->codec_inflated++;
+            argv[3] = dataValue(w->encoding, w->out, w->out_len, argv);
+        } else {
+            LOG_WARN(("payload has the compression header but does not inflate, returning it raw"));
+            argv[3] = BufferNew(w->in, w->in_len).ToLocalChecked();
+        }
+        free(w->in);
+        free(w->out);
+        delete w;
+
+        CALLBACK_EPILOG();
+    }
+
     static void Delete(const Nan::FunctionCallbackInfo<v8::Value>& info) {
         ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());   
         assert(zk);
-        Nan::Utf8String _path (info[0]->ToString());
+        PathArg _path (info[0]);
         uint32_t version = info[1]->Uint32Value();
 
         int ret = zoo_delete(zk->zhandle, *_path, version);
@@ -710,116 +1716,1075 @@ public:
     static void AGet(const Nan::FunctionCallbackInfo<v8::Value>& info) {
         A_METHOD_PROLOG(3);
 
-        Nan::Utf8String _path (info[0]->ToString());
+        PathArg _path (info[0]);
         bool watch = info[1]->ToBoolean()->BooleanValue();
 
-        METHOD_EPILOG(zoo_aget(zk->zhandle, *_path, watch, &data_completion, cb));
+        METHOD_EPILOG(zoo_aget(zk->zhandle, *_path, watch, &data_completion, readData(cb, info, 3)));
     }
 
     static void watcher_fn (zhandle_t *zh, int type, int state, const char *path, void *watcherCtx) {
+        if (zoo_state(zh) == ZOO_EXPIRED_SESSION_STATE) { return; }
+        ZooKeeper *zk = (ZooKeeper *) zoo_get_context(zh);
+        zk->events_raw++;
+        if (type != ZOO_SESSION_EVENT && zk->coalesce_window > 0) {
+            zk->queueEvent(type, state, path, (Nan::Callback *) watcherCtx);
+            return;
+        }
+        // as in main_watcher: a session event must not overtake the watch
+        // events queued before it
+        zk->flushEvents(true);
+        zk->events_delivered++;
+        deliverWatcher(zh, type, state, path, watcherCtx);
+    }
+
+    static void deliverWatcher (zhandle_t *zh, int type, int state, const char *path, void *watcherCtx) {
         WATCHER_PROLOG(4);
         WATCHER_CALLBACK_EPILOG();
     }
 
-    static void AWGet(const Nan::FunctionCallbackInfo<v8::Value>& info) {
-        AW_METHOD_PROLOG(3);
+    static unsigned eventHash (int type, const char *path, Nan::Callback *cb) {
+        // FNV-1a over the path, mixed with the type and the watcher
+        unsigned h = 2166136261u ^ (unsigned) type;
+        for (const char *p = path; *p; p++) {
+            h = (h ^ (unsigned char) *p) * 16777619u;
+        }
+        return h ^ (unsigned) ((uintptr_t) cb >> 4);
+    }
 
-        Nan::Utf8String _path (info[0]->ToString());
+    // Queues a watch event unless the same (path, type) is already waiting
+    // for the same receiver, then makes sure a flush is scheduled.
+    void queueEvent (int type, int state, const char *path, Nan::Callback *cb) {
+        if (path == NULL) {
+            path = "";
+        }
+        unsigned h = eventHash(type, path, cb);
+        struct queued_event **bucket = &event_buckets[h % EVENT_BUCKETS];
+        for (struct queued_event *e = *bucket; e; e = e->bucket_next) {
+            if (e->hash == h && e->type == type && e->cb == cb && strcmp(e->path, path) == 0) {
+                return;
+            }
+        }
+        struct queued_event *e = (struct queued_event *) malloc(sizeof(struct queued_event));
+        e->type = type;
+        e->state = state;
+        e->path = strdup(path);
+        e->cb = cb;
+        e->hash = h;
+        e->next = NULL;
+        e->bucket_next = *bucket;
+        *bucket = e;
+        if (event_tail) {
+            event_tail->next = e;
+        } else {
+            event_head = e;
+        }
+        event_tail = e;
+        event_queued++;
 
-        METHOD_EPILOG(zoo_awget(zk->zhandle, *_path, &watcher_fn, cbw, &data_completion, cb));
+        if (!uv_is_active((uv_handle_t *) event_timer)) {
+            uv_timer_start(event_timer, &event_timer_cb, coalesce_window, 0);
+        }
     }
 
-    static void ASet(const Nan::FunctionCallbackInfo<v8::Value>& info) {
-        A_METHOD_PROLOG(4);
+    struct queued_event *dequeueEvent () {
+        struct queued_event *e = event_head;
+        event_head = e->next;
+        if (!event_head) {
+            event_tail = NULL;
+        }
+        event_queued--;
+        for (struct queued_event **p = &event_buckets[e->hash % EVENT_BUCKETS]; *p; p = &(*p)->bucket_next) {
+            if (*p == e) {
+                *p = e->bucket_next;
+                break;
+            }
+        }
+        return e;
+    }
 
-        Nan::Utf8String _path (info[0]->ToString());
-        uint32_t version = info[2]->Uint32Value();
+    static Local<String> eventName (int type) {
+        if (type == ZOO_CREATED_EVENT) {
+            return Nan::New(on_event_created);
+        } else if (type == ZOO_DELETED_EVENT) {
+            return Nan::New(on_event_deleted);
+        } else if (type == ZOO_CHANGED_EVENT) {
+            return Nan::New(on_event_changed);
+        } else if (type == ZOO_CHILD_EVENT) {
+            return Nan::New(on_event_child);
+        }
+        return Nan::New(on_event_notwatching);
+    }
 
-        if (Buffer::HasInstance(info[1])) { // buffer
-            Local<Object> _data = info[1]->ToObject();
-            METHOD_EPILOG(zoo_aset(zk->zhandle, *_path, BufferData(_data), BufferLength(_data), version, &stat_completion, cb));
-        } else {    // other
-            Nan::Utf8String _data(info[1]->ToString());
-            METHOD_EPILOG(zoo_aset(zk->zhandle, *_path, *_data, _data.length(), version, &stat_completion, cb));
+    // Delivers queued events: handle events as one 'batch' array of
+    // { type, path }, aw_* watchers by calling them in queue order. Without
+    // `all`, at most coalesce_max events go out per loop iteration and the
+    // rest follow on the next timer tick, so a storm does not hold the loop.
+    void flushEvents (bool all) {
+        if (!event_head) {
+            return;
+        }
+        Nan::HandleScope scope;
+        Local<Array> batch = Nan::New<Array>();
+        uint32_t n = 0;
+        uint32_t delivered = 0;
+        while (event_head && (all || delivered < coalesce_max)) {
+            struct queued_event *e = dequeueEvent();
+            delivered++;
+            events_delivered++;
+            if (e->cb) {
+                if (zhandle && zoo_state(zhandle) != ZOO_EXPIRED_SESSION_STATE) {
+                    deliverWatcher(zhandle, e->type, e->state, e->path, e->cb);
+                }
+            } else {
+                Local<Object> o = Nan::New<Object>();
+                Nan::Set(o, LOCAL_STRING("type"), eventName(e->type));
+                Nan::Set(o, LOCAL_STRING("path"), pathString(e->path));
+                Nan::Set(batch, n++, o);
+            }
+            free(e->path);
+            free(e);
+        }
+        if (n > 0) {
+            event_batches++;
+            DoEmit(Nan::New(on_event_batch), batch);
+        }
+        if (event_head && !is_closed) {
+            uv_timer_start(event_timer, &event_timer_cb, 0, 0);
         }
     }
 
-    static void strings_completion (int rc, const struct String_vector *strings, const void *cb) {
-        CALLBACK_PROLOG(3);
+    static void event_timer_cb (uv_timer_t *handle) {
+        ZooKeeper *zk = static_cast<ZooKeeper *>(handle->data);
+        zk->flushEvents(false);
+    }
 
-        LOG_DEBUG(("rc=%d, rc_string=%s", rc, zerror(rc)));
+    void dropEvents () {
+        while (event_head) {
+            struct queued_event *e = dequeueEvent();
+            free(e->path);
+            free(e);
+        }
+    }
 
-        if (strings != NULL) {
-            Local<Array> ar = Nan::New<Array>((uint32_t)strings->count);
-            for (uint32_t i = 0; i < (uint32_t)strings->count; ++i) {
-                ar->Set(i, LOCAL_STRING(strings->data[i]));
+    // event_coalescing: window ms | { window, max_batch }
+    void configureCoalescing (Local<Value> v) {
+        coalesce_window = 0;
+        coalesce_max = 1000;
+        if (v->IsNumber()) {
+            coalesce_window = v->Uint32Value();
+        } else if (v->IsObject()) {
+            Local<Object> o = v->ToObject();
+            coalesce_window = o->Get(LOCAL_STRING("window"))->Uint32Value();
+            if (coalesce_window == 0) {
+                coalesce_window = 10;
+            }
+            Local<Value> max = o->Get(LOCAL_STRING("max_batch"));
+            if (!max->IsUndefined() && max->Uint32Value() > 0) {
+                coalesce_max = max->Uint32Value();
             }
-            argv[2] = ar;
-        } else {
-            argv[2] = Nan::Null().As<Object>();
         }
-
-        CALLBACK_EPILOG();
+        if (coalesce_window > 0 && !event_timer) {
+            event_buckets = (struct queued_event **) calloc(EVENT_BUCKETS, sizeof(struct queued_event *));
+            event_timer = (uv_timer_t *) malloc(sizeof(uv_timer_t));
+            uv_timer_init(uv_default_loop(), event_timer);
+            event_timer->data = this;
+            uv_unref((uv_handle_t *) event_timer);
+        }
     }
 
-    static void AGetChildren(const Nan::FunctionCallbackInfo<v8::Value>& info) {
-        A_METHOD_PROLOG(3);
-
-        Nan::Utf8String _path (info[0]->ToString());
-        bool watch = info[1]->ToBoolean()->BooleanValue();
+    // Deadlines and cancellation. METHOD_EPILOG hands every queued request
+    // to armDeadline, which tracks it when op_timeout or set_next_op asks
+    // for it. Entries with a deadline sit in a hashed timer wheel of
+    // DEADLINE_SLOTS slots of DEADLINE_TICK ms, advanced from zk_timer. All
+    // entries are found by callback through a small hash table, which is
+    // how CALLBACK_EPILOG recognises the late completion of a request that
+    // was already answered.
 
-        METHOD_EPILOG(zoo_aget_children(zk->zhandle, *_path, watch, &strings_completion, cb));
+    static unsigned deadlineBucket (Nan::Callback *cb) {
+        return (unsigned) (((uintptr_t) cb >> 4) % DEADLINE_BUCKETS);
     }
 
-    static void AWGetChildren(const Nan::FunctionCallbackInfo<v8::Value>& info) {
-        AW_METHOD_PROLOG(3);
+    static unsigned deadlineSlot (int64_t at) {
+        return (unsigned) ((at / DEADLINE_TICK) % DEADLINE_SLOTS);
+    }
 
-        Nan::Utf8String _path (info[0]->ToString());
+    // cb is NULL when the request was not queued; the set_next_op values
+    // are used up either way
+    void armDeadline (Nan::Callback *cb) {
+        uint32_t timeout = next_op_timeout ? next_op_timeout : op_timeout;
+        uint32_t token = next_op_token;
+        next_op_timeout = next_op_token = 0;
+        if (!cb || (timeout == 0 && token == 0)) {
+            return;
+        }
+        int64_t now = uv_now(uv_default_loop());
+        if (!deadline_buckets) {
+            deadline_buckets = (struct op_deadline **) calloc(DEADLINE_BUCKETS, sizeof(struct op_deadline *));
+            deadline_slots = (struct op_deadline **) calloc(DEADLINE_SLOTS, sizeof(struct op_deadline *));
+            wheel_time = now;
+        }
+        struct op_deadline *d = (struct op_deadline *) malloc(sizeof(struct op_deadline));
+        d->cb = cb;
+        d->at = timeout ? now + timeout : 0;
+        d->token = token;
+        d->rc = ZOK;
+        d->due = false;
+        d->slot_next = NULL;
+        unsigned b = deadlineBucket(cb);
+        d->bucket_next = deadline_buckets[b];
+        deadline_buckets[b] = d;
+        deadlines_pending++;
+        if (d->at) {
+            unsigned slot = deadlineSlot(d->at);
+            d->slot_next = deadline_slots[slot];
+            deadline_slots[slot] = d;
+            if (deadlines_timed++ == 0) {
+                // zk_timer may be hours away; make it tick the wheel
+                wheel_time = now;
+                uv_timer_start(&zk_timer, &zk_timer_cb, DEADLINE_TICK, DEADLINE_TICK);
+            }
+        }
+    }
 
-        METHOD_EPILOG(zoo_awget_children(zk->zhandle, *_path, &watcher_fn, cbw, &strings_completion, cb));
+    struct op_deadline *findDeadline (Nan::Callback *cb) {
+        if (deadlines_pending == 0) {
+            return NULL;
+        }
+        struct op_deadline *d = deadline_buckets[deadlineBucket(cb)];
+        while (d && d->cb != cb) {
+            d = d->bucket_next;
+        }
+        return d;
     }
 
-    static void strings_stat_completion (int rc, const struct String_vector *strings, const struct Stat *stat, const void *cb) {
-        CALLBACK_PROLOG(4);
+    bool deadlineAnswered (Nan::Callback *cb) {
+        struct op_deadline *d = findDeadline(cb);
+        return d && d->rc != ZOK;
+    }
 
-        LOG_DEBUG(("rc=%d, rc_string=%s", rc, zerror(rc)));
+    void unlinkDeadlineSlot (struct op_deadline *d) {
+        struct op_deadline **p = &deadline_slots[deadlineSlot(d->at)];
+        while (*p && *p != d) {
+            p = &(*p)->slot_next;
+        }
+        if (*p) {
+            *p = d->slot_next;
+            deadlines_timed--;
+        }
+    }
 
-        if (strings != NULL) {
-            Local<Array> ar = Nan::New<Array>((uint32_t)strings->count);
-            for (uint32_t i = 0; i < (uint32_t)strings->count; ++i) {
-                ar->Set(i, LOCAL_STRING(strings->data[i]));
-            }
-            argv[2] = ar;
+    // Called by CALLBACK_EPILOG when the C client completes a request.
+    // Returns true when the request was answered already and the
+    // completion must not reach the callback.
+    bool settleDeadline (Nan::Callback *cb) {
+        struct op_deadline *d = findDeadline(cb);
+        if (!d) {
+            return false;
+        }
+        struct op_deadline **p = &deadline_buckets[deadlineBucket(cb)];
+        while (*p != d) {
+            p = &(*p)->bucket_next;
+        }
+        *p = d->bucket_next;
+        deadlines_pending--;
+        if (d->rc == ZOK && d->at && !d->due) {
+            unlinkDeadlineSlot(d);
+        }
+        bool answered = d->rc != ZOK;
+        if (answered) {
+            late_completions++;
+        }
+        if (d->due) {
+            // fireDeadlines is walking this entry's list; it frees it
+            d->cb = NULL;
         } else {
-            argv[2] = Nan::Null().As<Object>();
+            free(d);
         }
+        return answered;
+    }
 
-        argv[3] = (stat != 0 ? zkk->createStatObject (stat) : Nan::Null().As<Object>());
-
-        CALLBACK_EPILOG();
+    // Answers the entries of a list built by expireDeadlines or
+    // CancelToken. A callback may close the handle, which completes (and
+    // settles) every pending request, so each entry is checked right
+    // before its callback runs.
+    void fireDeadlines (struct op_deadline *due, int rc) {
+        for (struct op_deadline *d = due; d; d = d->slot_next) {
+            if (!d->cb) {
+                continue;
+            }
+            d->rc = rc;
+            if (rc == ZCANCELLED) {
+                ops_cancelled++;
+            } else {
+                ops_timed_out++;
+            }
+            Nan::HandleScope scope;
+            Local<Value> argv[2];
+            argv[0] = Nan::New<Int32>(rc);
+            argv[1] = LOCAL_STRING(zk_error(rc));
+            d->cb->Call(2, argv);
+        }
+        struct op_deadline *next;
+        for (struct op_deadline *d = due; d; d = next) {
+            next = d->slot_next;
+            d->due = false;
+            d->slot_next = NULL;
+            if (!d->cb) {
+                free(d);
+            }
+        }
     }
 
-    static void AGetChildren2(const Nan::FunctionCallbackInfo<v8::Value>& info) {
-        A_METHOD_PROLOG(3);
+    void expireDeadlines (int64_t now) {
+        struct op_deadline *due = NULL;
+        int64_t ticks = now / DEADLINE_TICK - wheel_time / DEADLINE_TICK;
+        if (ticks >= DEADLINE_SLOTS) {
+            ticks = DEADLINE_SLOTS - 1;
+        }
+        for (int64_t t = 0; t <= ticks; t++) {
+            struct op_deadline **p = &deadline_slots[deadlineSlot(now - t * DEADLINE_TICK)];
+            while (*p) {
+                struct op_deadline *d = *p;
+                if (d->at <= now) {
+                    *p = d->slot_next;
+                    deadlines_timed--;
+                    d->due = true;
+                    d->slot_next = due;
+                    due = d;
+                } else {
+                    // a later turn of the wheel
+                    p = &d->slot_next;
+                }
+            }
+        }
+        wheel_time = now;
+        if (due) {
+            fireDeadlines(due, ZOPERATIONTIMEOUT);
+        }
+    }
 
-        Nan::Utf8String _path (info[0]->ToString());
-        bool watch = info[1]->ToBoolean()->BooleanValue();
+    // the delay for zk_timer, shortened to the wheel tick while deadlines
+    // are pending
+    int64_t timerDelay (int64_t delay) {
+        return deadlines_timed > 0 && delay > DEADLINE_TICK ? DEADLINE_TICK : delay;
+    }
 
-        METHOD_EPILOG(zoo_aget_children2(zk->zhandle, *_path, watch, &strings_stat_completion, cb));
+    void freeDeadlines () {
+        if (!deadline_buckets) {
+            return;
+        }
+        for (int i = 0; i < DEADLINE_BUCKETS; i++) {
+            struct op_deadline *next;
+            for (struct op_deadline *d = deadline_buckets[i]; d; d = next) {
+                next = d->bucket_next;
+                if (d->due) {
+                    d->cb = NULL;
+                } else {
+                    free(d);
+                }
+            }
+        }
+        free(deadline_buckets);
+        free(deadline_slots);
+        deadline_buckets = deadline_slots = NULL;
+        deadlines_pending = deadlines_timed = 0;
     }
 
-    static void AWGetChildren2(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+    // set_next_op(timeout_ms, token): a deadline and a cancellation token
+    // for the next request only; 0 leaves the deadline at op_timeout
+    static void SetNextOp(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());
+        assert(zk);
+        zk->next_op_timeout = info[0]->Uint32Value();
+        zk->next_op_token = info[1]->Uint32Value();
+        RETURN_VALUE(info, Nan::Undefined());
+    }
+
+    // cancel(token): answers the pending requests issued with token with
+    // ZCANCELLED; returns how many there were
+    static void CancelToken(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());
+        assert(zk);
+        uint32_t token = info[0]->Uint32Value();
+        struct op_deadline *due = NULL;
+        int count = 0;
+        if (token && zk->deadlines_pending > 0) {
+            for (int i = 0; i < DEADLINE_BUCKETS; i++) {
+                for (struct op_deadline *d = zk->deadline_buckets[i]; d; d = d->bucket_next) {
+                    if (d->token != token || d->rc != ZOK || d->due) {
+                        continue;
+                    }
+                    if (d->at) {
+                        zk->unlinkDeadlineSlot(d);
+                    }
+                    d->due = true;
+                    d->slot_next = due;
+                    due = d;
+                    count++;
+                }
+            }
+        }
+        if (due) {
+            zk->fireDeadlines(due, ZCANCELLED);
+        }
+        RETURN_VALUE(info, Nan::New<Int32>(count));
+    }
+
+    static void AWGet(const Nan::FunctionCallbackInfo<v8::Value>& info) {
         AW_METHOD_PROLOG(3);
 
-        Nan::Utf8String _path (info[0]->ToString());
+        PathArg _path (info[0]);
+
+        METHOD_EPILOG(zoo_awget(zk->zhandle, *_path, &watcher_fn, cbw, &data_completion, readData(cb, info, 3)));
+    }
+
+    // like data_completion, but copies the value into the caller's Buffer
+    // instead of allocating a new one
+    static void into_completion (int rc, const char *value, int value_len, const struct Stat *stat, const void *data) {
+        struct into_data *d = (struct into_data *) data;
+        void *cb = (void *) d->cb;
+
+        CALLBACK_PROLOG(4);
+
+        LOG_DEBUG(("rc=%d, rc_string=%s, value_len=%d, offset=%lu", rc, zerror(rc), value_len, (unsigned long) d->offset));
+
+        argv[2] = stat != 0 ? zkk->createStatObject (stat) : Nan::Null().As<Object>();
+        argv[3] = Nan::New<Int32>(0);
+
+        // after a deadline the caller may have reused the buffer
+        if (value != 0 && !zkk->deadlineAnswered(callback)) {
+            Local<Object> target = Nan::New(d->target);
+            size_t capacity = BufferLength(target);
+            size_t n = (size_t) value_len;
+            if (d->offset >= capacity) {
+                n = 0;
+            } else if (n > capacity - d->offset) {
+                n = capacity - d->offset;
+            }
+            memcpy(BufferData(target) + d->offset, value, n);
+            argv[3] = Nan::New<Int32>(value_len);
+        }
+
+        d->target.Reset();
+        delete d;
+
+        CALLBACK_EPILOG();
+    }
+
+    // a_get_into(path, buffer, offset, cb(rc, error, stat, value_length))
+    static void AGetInto(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        A_METHOD_PROLOG(4);
+
+        PathArg _path (info[0]);
+        THROW_IF_NOT (Buffer::HasInstance(info[1]), "a_get_into: target must be a Buffer");
+
+        struct into_data *data = new into_data();
+        data->cb = cb;
+        data->target.Reset(info[1]->ToObject());
+        data->offset = info[2]->Uint32Value();
+
+        int ret = zoo_aget(zk->zhandle, *_path, 0, &into_completion, data);
+        if (ret != ZOK) {
+            data->target.Reset();
+            delete data;
+        }
+        zk->armDeadline(ret == ZOK ? cb : NULL);
+        RETURN_VALUE(info, Nan::New<Int32>(ret));
+    }
+
+    static void ASet(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        A_METHOD_PROLOG(4);
+
+        PathArg _path (info[0]);
+        uint32_t version = info[2]->Uint32Value();
+        Payload _data (zk, *_path, info[1]);
+
+        METHOD_EPILOG(zoo_aset(zk->zhandle, *_path, _data.data, _data.len, version, &stat_completion, cb));
+    }
+
+    static void strings_completion (int rc, const struct String_vector *strings, const void *cb) {
+        CALLBACK_PROLOG(3);
+
+        LOG_DEBUG(("rc=%d, rc_string=%s", rc, zerror(rc)));
+
+        if (strings != NULL) {
+            Local<Array> ar = Nan::New<Array>((uint32_t)strings->count);
+            for (uint32_t i = 0; i < (uint32_t)strings->count; ++i) {
+                ar->Set(i, LOCAL_STRING(strings->data[i]));
+            }
+            argv[2] = ar;
+        } else {
+            argv[2] = Nan::Null().As<Object>();
+        }
+
+        CALLBACK_EPILOG();
+    }
+
+    static void AGetChildren(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        A_METHOD_PROLOG(3);
+
+        PathArg _path (info[0]);
+        bool watch = info[1]->ToBoolean()->BooleanValue();
+
+        METHOD_EPILOG(zoo_aget_children(zk->zhandle, *_path, watch, &strings_completion, cb));
+    }
+
+    static void AWGetChildren(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        AW_METHOD_PROLOG(3);
+
+        PathArg _path (info[0]);
+
+        METHOD_EPILOG(zoo_awget_children(zk->zhandle, *_path, &watcher_fn, cbw, &strings_completion, cb));
+    }
+
+    static void strings_stat_completion (int rc, const struct String_vector *strings, const struct Stat *stat, const void *cb) {
+        CALLBACK_PROLOG(4);
+
+        LOG_DEBUG(("rc=%d, rc_string=%s", rc, zerror(rc)));
+
+        if (strings != NULL) {
+            Local<Array> ar = Nan::New<Array>((uint32_t)strings->count);
+            for (uint32_t i = 0; i < (uint32_t)strings->count; ++i) {
+                ar->Set(i, LOCAL_STRING(strings->data[i]));
+            }
+            argv[2] = ar;
+        } else {
+            argv[2] = Nan::Null().As<Object>();
+        }
+
+        argv[3] = (stat != 0 ? zkk->createStatObject (stat) : Nan::Null().As<Object>());
+
+        CALLBACK_EPILOG();
+    }
+
+    static void AGetChildren2(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        A_METHOD_PROLOG(3);
+
+        PathArg _path (info[0]);
+        bool watch = info[1]->ToBoolean()->BooleanValue();
+
+        METHOD_EPILOG(zoo_aget_children2(zk->zhandle, *_path, watch, &strings_stat_completion, cb));
+    }
+
+    static void AWGetChildren2(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        AW_METHOD_PROLOG(3);
+
+        PathArg _path (info[0]);
 
         METHOD_EPILOG(zoo_awget_children2(zk->zhandle, *_path, &watcher_fn, cbw, &strings_stat_completion, cb));
     }
 
+    static int compareNames (const void *a, const void *b) {
+        return strcmp(*(const char * const *) a, *(const char * const *) b);
+    }
+
+    // Copies a child list into one block and sorts it.
+    static char **copyChildren (const struct String_vector *strings) {
+        size_t bytes = strings->count * sizeof(char *);
+        for (int i = 0; i < strings->count; i++) {
+            bytes += strlen(strings->data[i]) + 1;
+        }
+        char **names = (char **) malloc(bytes > 0 ? bytes : 1);
+        char *p = (char *) (names + strings->count);
+        for (int i = 0; i < strings->count; i++) {
+            size_t len = strlen(strings->data[i]) + 1;
+            memcpy(p, strings->data[i], len);
+            names[i] = p;
+            p += len;
+        }
+        qsort(names, strings->count, sizeof(char *), compareNames);
+        return names;
+    }
+
+    int fetchChildren (struct child_watch *w) {
+        w->in_flight = true;
+        int rc = zoo_awget_children(zhandle, w->path, &child_watcher, w, &child_watch_completion, w);
+        if (rc != ZOK) {
+            w->in_flight = false;
+        }
+        return rc;
+    }
+
+    void unlinkChildWatch (struct child_watch *w) {
+        for (struct child_watch **p = &child_watches; *p; p = &(*p)->next) {
+            if (*p == w) {
+                *p = w->next;
+                break;
+            }
+        }
+        free(w->children);
+        free(w->path);
+        delete w->cb;
+        free(w);
+    }
+
+    // after a reconnect every subscription starts over with the full set
+    void refreshChildWatches () {
+        for (struct child_watch *w = child_watches; w; w = w->next) {
+            if (!w->cancelled && !w->in_flight) {
+                w->full = true;
+                fetchChildren(w);
+            }
+        }
+    }
+
+    static void child_watcher (zhandle_t *zh, int type, int state, const char *path, void *watcherCtx) {
+        struct child_watch *w = (struct child_watch *) watcherCtx;
+        // session events are handled for all subscriptions in main_watcher
+        if (type == ZOO_SESSION_EVENT || type == ZOO_NOTWATCHING_EVENT) {
+            return;
+        }
+        w->armed = false;
+        if (w->cancelled) {
+            w->zk->unlinkChildWatch(w);
+            return;
+        }
+        // a child event re-arms the watch; a deleted event ends in ZNONODE
+        if (w->zk->fetchChildren(w) != ZOK) {
+            w->full = true; // retried by the next connect
+        }
+    }
+
+    static void child_watch_completion (int rc, const struct String_vector *strings, const void *data) {
+        struct child_watch *w = (struct child_watch *) data;
+        ZooKeeper *zk = w->zk;
+        w->in_flight = false;
+        if (rc == ZCLOSING) {
+            return; // realClose releases the subscriptions
+        }
+        if (rc == ZOK) {
+            w->armed = true;
+        }
+        if (w->cancelled) {
+            if (!w->armed) {
+                zk->unlinkChildWatch(w);
+            }
+            return;
+        }
+
+        Nan::HandleScope scope;
+        LOG_DEBUG(("rc=%d, rc_string=%s, path=%s", rc, zerror(rc), w->path));
+
+        Local<Value> argv[5];
+        argv[0] = Nan::New<Int32>(rc);
+        argv[1] = LOCAL_STRING(zk_error(rc));
+        argv[2] = Nan::Null();
+        argv[3] = Nan::Null();
+        argv[4] = Nan::New<Boolean>(w->full);
+
+        if (rc == ZOK) {
+            char **names = copyChildren(strings);
+            int count = strings->count;
+            Local<Array> added = Nan::New<Array>();
+            Local<Array> removed = Nan::New<Array>();
+            if (w->full) {
+                for (int i = 0; i < count; i++) {
+                    Nan::Set(added, i, LOCAL_STRING(names[i]));
+                }
+            } else {
+                // merge walk of the two sorted sets
+                uint32_t na = 0, nr = 0;
+                int i = 0, j = 0;
+                while (i < w->count || j < count) {
+                    int c = i == w->count ? 1 : (j == count ? -1 : strcmp(w->children[i], names[j]));
+                    if (c < 0) {
+                        Nan::Set(removed, nr++, LOCAL_STRING(w->children[i++]));
+                    } else if (c > 0) {
+                        Nan::Set(added, na++, LOCAL_STRING(names[j++]));
+                    } else {
+                        i++;
+                        j++;
+                    }
+                }
+            }
+            free(w->children);
+            w->children = names;
+            w->count = count;
+            w->full = false;
+            argv[2] = added;
+            argv[3] = removed;
+        } else if (rc == ZNONODE) {
+            // the parent is gone; report its last children as removed and
+            // end the subscription, as no watch could be set
+            Local<Array> removed = Nan::New<Array>(w->count);
+            for (int i = 0; i < w->count; i++) {
+                Nan::Set(removed, i, LOCAL_STRING(w->children[i]));
+            }
+            argv[2] = Nan::New<Array>();
+            argv[3] = removed;
+        } else {
+            // e.g. connection loss: the next connect refreshes the full set
+            w->full = true;
+        }
+
+        w->in_callback = true;
+        w->cb->Call(5, argv);
+        // the callback may have closed the handle, which frees w
+        if (zk->is_closed) {
+            return;
+        }
+        w->in_callback = false;
+        // one unlink, also for an unwatch_children from inside the callback
+        if (rc == ZNONODE || (w->cancelled && !w->armed && !w->in_flight)) {
+            zk->unlinkChildWatch(w);
+        }
+    }
+
+    // watch_children(path, cb(rc, error, added, removed, full))
+    static void WatchChildren(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());
+        assert(zk);
+        THROW_IF_NOT (info.Length() >= 2, "expected 2 arguments")
+        THROW_IF_NOT (info[1]->IsFunction(), "watch_children: callback must be a function")
+
+        PathArg _path (info[0]);
+
+        struct child_watch *w = (struct child_watch *) calloc(1, sizeof(struct child_watch));
+        w->zk = zk;
+        w->path = strdup(*_path);
+        w->cb = new Nan::Callback(info[1].As<Function>());
+        w->full = true;
+        w->next = zk->child_watches;
+        zk->child_watches = w;
+
+        int rc = zk->fetchChildren(w);
+        if (rc != ZOK) {
+            zk->unlinkChildWatch(w);
+        }
+        RETURN_VALUE(info, Nan::New<Int32>(rc));
+    }
+
+    // unwatch_children(path, cb): the callback is not called again. The
+    // subscription itself is released once its watch has fired, since the
+    // 3.4 client cannot remove a registered watch.
+    static void UnwatchChildren(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());
+        assert(zk);
+        THROW_IF_NOT (info.Length() >= 2, "expected 2 arguments")
+
+        PathArg _path (info[0]);
+        bool found = false;
+        struct child_watch *next;
+        for (struct child_watch *w = zk->child_watches; w; w = next) {
+            next = w->next;
+            if (!w->cancelled && strcmp(w->path, *_path) == 0 && w->cb->GetFunction()->StrictEquals(info[1])) {
+                w->cancelled = true;
+                found = true;
+                if (!w->armed && !w->in_flight && !w->in_callback) {
+                    zk->unlinkChildWatch(w);
+                }
+            }
+        }
+        RETURN_VALUE(info, Nan::New<Boolean>(found));
+    }
+
+    static struct subtree_walk *findWalk (ZooKeeper *zk, int32_t id) {
+        for (struct subtree_walk *w = zk->walks; w; w = w->next) {
+            if (w->id == id) {
+                return w;
+            }
+        }
+        return NULL;
+    }
+
+    static void walkEnqueue (struct subtree_walk *w, const char *path, int depth) {
+        for (int i = 0; i < w->exclude_count; i++) {
+            if (strcmp(path, w->exclude[i]) == 0) {
+                return;
+            }
+        }
+        struct walk_node *n = (struct walk_node *) malloc(sizeof(struct walk_node));
+        n->path = strdup(path);
+        n->depth = depth;
+        n->next = NULL;
+        if (w->tail) {
+            w->tail->next = n;
+        } else {
+            w->head = n;
+        }
+        w->tail = n;
+    }
+
+    static struct walk_req *walkRequest (struct subtree_walk *w, const char *path, int depth) {
+        struct walk_req *r = (struct walk_req *) malloc(sizeof(struct walk_req));
+        r->w = w;
+        r->path = strdup(path);
+        r->depth = depth;
+        w->in_flight++;
+        return r;
+    }
+
+    static void freeWalkRequest (struct walk_req *r) {
+        r->w->in_flight--;
+        free(r->path);
+        free(r);
+    }
+
+    void freeWalk (struct subtree_walk *w) {
+        for (struct subtree_walk **p = &walks; *p; p = &(*p)->next) {
+            if (*p == w) {
+                *p = w->next;
+                break;
+            }
+        }
+        while (w->head) {
+            struct walk_node *n = w->head;
+            w->head = n->next;
+            free(n->path);
+            free(n);
+        }
+        for (int i = 0; i < w->exclude_count; i++) {
+            free(w->exclude[i]);
+        }
+        free(w->exclude);
+        delete w->cb;
+        free(w);
+    }
+
+    // cb(rc, error, path, stat, data); path is null once the walk is over
+    static void walkDeliver (struct subtree_walk *w, int rc, const char *path, const struct Stat *stat, const char *value, int value_len) {
+        Nan::HandleScope scope;
+        Local<Value> argv[5];
+        argv[0] = Nan::New<Int32>(rc);
+        argv[1] = LOCAL_STRING(zk_error(rc));
+        argv[2] = path ? pathString(path).As<Value>() : Nan::Null().As<Value>();
+        argv[3] = stat ? w->zk->createStatObject(stat).As<Value>() : Nan::Null().As<Value>();
+        argv[4] = Nan::Null();
+        if (value != NULL) {
+            char *out;
+            int out_len;
+            if (zk_codec_is_encoded(value, value_len) && w->zk->codec_enabled && zk_codec_decompress(value, value_len, &out, &out_len)) {
+                argv[4] = BufferNew(out, out_len).ToLocalChecked();
+                free(out);
+            } else {
+                argv[4] = BufferNew(value, value_len).ToLocalChecked();
+            }
+        }
+        w->cb->Call(5, argv);
+    }
+
+    // Issues requests for queued znodes while the window has room, and ends
+    // the walk when nothing is queued or in flight.
+    static void walkPump (struct subtree_walk *w) {
+        ZooKeeper *zk = w->zk;
+        while (!w->cancelled && !w->paused && w->head && w->in_flight < w->window) {
+            struct walk_node *n = w->head;
+            w->head = n->next;
+            if (!w->head) {
+                w->tail = NULL;
+            }
+            bool descend = w->max_depth < 0 || n->depth < w->max_depth;
+            // a request the C client refused never completes: free it here
+            struct walk_req *r = walkRequest(w, n->path, n->depth);
+            int rc;
+            if (w->with_data) {
+                rc = zoo_aget(zk->zhandle, n->path, 0, &walk_data_completion, r);
+                if (rc != ZOK) {
+                    freeWalkRequest(r);
+                } else if (descend) {
+                    r = walkRequest(w, n->path, n->depth);
+                    rc = zoo_aget_children(zk->zhandle, n->path, 0, &walk_children_completion, r);
+                    if (rc != ZOK) {
+                        freeWalkRequest(r);
+                    }
+                }
+            } else {
+                if (descend) {
+                    // one request gives both the stat and the children
+                    rc = zoo_aget_children2(zk->zhandle, n->path, 0, &walk_children2_completion, r);
+                } else {
+                    rc = zoo_aexists(zk->zhandle, n->path, 0, &walk_stat_completion, r);
+                }
+                if (rc != ZOK) {
+                    freeWalkRequest(r);
+                }
+            }
+            free(n->path);
+            free(n);
+            if (rc != ZOK) {
+                // the requests that made it out still complete; the walk
+                // ends with this error
+                w->cancelled = true;
+                walkDeliverEnd(w, rc);
+            }
+        }
+        if (w->in_flight == 0 && (w->cancelled || !w->head)) {
+            if (!w->cancelled) {
+                w->cancelled = true;
+                walkDeliverEnd(w, ZOK);
+            }
+            zk->freeWalk(w);
+        }
+    }
+
+    // The end of a walk, delivered from walkPump where no request holds the
+    // walk. The extra in_flight reference keeps a close() or walk_cancel()
+    // in the callback from freeing w; walkPump frees it afterwards.
+    static void walkDeliverEnd (struct subtree_walk *w, int rc) {
+        w->in_flight++;
+        walkDeliver(w, rc, NULL, NULL, NULL, 0);
+        w->in_flight--;
+    }
+
+    // Common handling of a completed walk request. Returns false when the
+    // result must not be delivered.
+    static bool walkCompleted (struct walk_req *r, int rc) {
+        struct subtree_walk *w = r->w;
+        if (w->cancelled) {
+            return false;
+        }
+        if (rc == ZNONODE) {
+            return false; // deleted while we were walking
+        }
+        if (rc != ZOK) {
+            w->cancelled = true;
+            walkDeliver(w, rc, NULL, NULL, NULL, 0);
+            return false;
+        }
+        w->visited++;
+        return true;
+    }
+
+    static void walkChildren (struct walk_req *r, const struct String_vector *strings) {
+        bool root = strcmp(r->path, "/") == 0;
+        size_t parent_len = root ? 0 : strlen(r->path);
+        for (int i = 0; i < strings->count; i++) {
+            size_t len = parent_len + strlen(strings->data[i]) + 2;
+            char *child = (char *) malloc(len);
+            snprintf(child, len, "%s/%s", root ? "" : r->path, strings->data[i]);
+            walkEnqueue(r->w, child, r->depth + 1);
+            free(child);
+        }
+    }
+
+    static void walkFinish (struct walk_req *r) {
+        struct subtree_walk *w = r->w;
+        freeWalkRequest(r);
+        walkPump(w);
+    }
+
+    static void walk_data_completion (int rc, const char *value, int value_len, const struct Stat *stat, const void *data) {
+        struct walk_req *r = (struct walk_req *) data;
+        if (walkCompleted(r, rc)) {
+            walkDeliver(r->w, rc, r->path, stat, value ? value : "", value ? value_len : 0);
+        }
+        walkFinish(r);
+    }
+
+    static void walk_stat_completion (int rc, const struct Stat *stat, const void *data) {
+        struct walk_req *r = (struct walk_req *) data;
+        if (walkCompleted(r, rc)) {
+            walkDeliver(r->w, rc, r->path, stat, NULL, 0);
+        }
+        walkFinish(r);
+    }
+
+    static void walk_children_completion (int rc, const struct String_vector *strings, const void *data) {
+        struct walk_req *r = (struct walk_req *) data;
+        if (!r->w->cancelled && rc == ZOK) {
+            walkChildren(r, strings);
+        } else if (!r->w->cancelled && rc != ZNONODE) {
+            r->w->cancelled = true;
+            walkDeliver(r->w, rc, NULL, NULL, NULL, 0);
+        }
+        walkFinish(r);
+    }
+
+    static void walk_children2_completion (int rc, const struct String_vector *strings, const struct Stat *stat, const void *data) {
+        struct walk_req *r = (struct walk_req *) data;
+        if (walkCompleted(r, rc)) {
+            walkDeliver(r->w, rc, r->path, stat, NULL, 0);
+            if (!r->w->cancelled) {
+                walkChildren(r, strings);
+            }
+        }
+        walkFinish(r);
+    }
+
+    // walk(root, { depth, window, data, exclude }, cb(rc, error, path, stat, data))
+    // returns a walk id for walk_pause/walk_resume/walk_cancel
+    static void Walk(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());
+        assert(zk);
+        THROW_IF_NOT (info.Length() >= 3, "expected 3 arguments")
+        THROW_IF_NOT (info[1]->IsObject(), "walk: options must be an object")
+        THROW_IF_NOT (info[2]->IsFunction(), "walk: callback must be a function")
+        THROW_IF_NOT (zk->zhandle, "walk: not initialized")
+
+        PathArg _path (info[0]);
+        Local<Object> o = info[1]->ToObject();
+
+        struct subtree_walk *w = (struct subtree_walk *) calloc(1, sizeof(struct subtree_walk));
+        w->zk = zk;
+        w->id = ++zk->walk_last_id;
+        w->cb = new Nan::Callback(info[2].As<Function>());
+        Local<Value> depth = o->Get(LOCAL_STRING("depth"));
+        w->max_depth = depth->IsUndefined() ? -1 : depth->Int32Value();
+        Local<Value> with_data = o->Get(LOCAL_STRING("data"));
+        w->with_data = with_data->IsUndefined() || with_data->BooleanValue();
+        w->window = o->Get(LOCAL_STRING("window"))->Int32Value();
+        if (w->window <= 0) {
+            w->window = 64;
+        }
+        Local<Value> exclude = o->Get(LOCAL_STRING("exclude"));
+        if (exclude->IsArray()) {
+            Local<Array> arr = Local<Array>::Cast(exclude);
+            w->exclude_count = arr->Length();
+            w->exclude = (char **) calloc(w->exclude_count > 0 ? w->exclude_count : 1, sizeof(char *));
+            for (int i = 0; i < w->exclude_count; i++) {
+                Nan::Utf8String prefix (arr->Get(i)->ToString());
+                w->exclude[i] = strdup(*prefix);
+            }
+        }
+        w->next = zk->walks;
+        zk->walks = w;
+
+        walkEnqueue(w, *_path, 0);
+        int32_t id = w->id;
+        walkPump(w);
+        RETURN_VALUE(info, Nan::New<Int32>(id));
+    }
+
+    // walk_pause(id) stops issuing requests; those in flight still deliver
+    static void WalkPause(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());
+        assert(zk);
+        struct subtree_walk *w = findWalk(zk, info[0]->Int32Value());
+        if (w) {
+            w->paused = true;
+        }
+        RETURN_VALUE(info, Nan::New<Boolean>(w != NULL));
+    }
+
+    static void WalkResume(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());
+        assert(zk);
+        struct subtree_walk *w = findWalk(zk, info[0]->Int32Value());
+        if (w && w->paused) {
+            w->paused = false;
+            walkPump(w);
+        }
+        RETURN_VALUE(info, Nan::New<Boolean>(w != NULL));
+    }
+
+    // walk_cancel(id): nothing more is delivered, not even the end
+    static void WalkCancel(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());
+        assert(zk);
+        struct subtree_walk *w = findWalk(zk, info[0]->Int32Value());
+        if (w && !w->cancelled) {
+            w->cancelled = true;
+            if (w->in_flight == 0) {
+                zk->freeWalk(w);
+            }
+        }
+        RETURN_VALUE(info, Nan::New<Boolean>(w != NULL));
+    }
+
     static void AGetAcl(const Nan::FunctionCallbackInfo<v8::Value>& info) {
         A_METHOD_PROLOG(2);
 
-        Nan::Utf8String _path (info[0]->ToString());
+        PathArg _path (info[0]);
 
         METHOD_EPILOG(zoo_aget_acl(zk->zhandle, *_path, &acl_completion, cb));
     }
@@ -827,28 +2792,246 @@ public:
     static void ASetAcl(const Nan::FunctionCallbackInfo<v8::Value>& info) {
         A_METHOD_PROLOG(4);
 
-        Nan::Utf8String _path (info[0]->ToString());
+        PathArg _path (info[0]);
         uint32_t _version = info[1]->Uint32Value();
-        Local<Array> arr = Local<Array>::Cast(info[2]);
-
-        struct ACL_vector *aclv = zk->createAclVector(arr);
+        AclArg _acl (info[2]);
 
         struct completion_data *data = (struct completion_data *) malloc(sizeof(struct completion_data));
         data->cb = cb;
         data->type = ZOO_SETACL_OP;
-        data->data = aclv;
+        data->data = NULL;
 
-        METHOD_EPILOG(zoo_aset_acl(zk->zhandle, *_path, _version, aclv, void_completion, data));
+        METHOD_EPILOG(zoo_aset_acl(zk->zhandle, *_path, _version, const_cast<struct ACL_vector *>(_acl.vector), void_completion, data));
     }
 
     static void ASync(const Nan::FunctionCallbackInfo<v8::Value>& info) {
         A_METHOD_PROLOG(2);
 
-        Nan::Utf8String _path (info[0]->ToString());
+        PathArg _path (info[0]);
 
         METHOD_EPILOG(zoo_async(zk->zhandle, *_path, &string_completion, cb));
     }
 
+    // Linearizable reads share one in-flight sync per handle. A read that
+    // arrives while no sync is outstanding issues one and is pipelined right
+    // behind it (the server processes a session's requests in order). Reads
+    // that arrive while a sync is in flight wait for it to complete and then
+    // share the next one.
+    static void AGetLinearizable(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        A_METHOD_PROLOG(3);
+
+        PathArg _path (info[0]);
+        bool watch = info[1]->ToBoolean()->BooleanValue();
+        struct read_data *d = readData(cb, info, 3);
+
+        zk->sync_reads++;
+
+        if (zk->sync_in_flight) {
+            struct sync_read *r = (struct sync_read *) malloc(sizeof(struct sync_read));
+            r->path = strdup(*_path);
+            r->watch = watch;
+            r->read = d;
+            r->next = NULL;
+            if (zk->sync_waiting_tail) {
+                zk->sync_waiting_tail->next = r;
+            } else {
+                zk->sync_waiting_head = r;
+            }
+            zk->sync_waiting_tail = r;
+            zk->armDeadline(cb);
+            RETURN_VALUE(info, Nan::New<Int32>(ZOK));
+            return;
+        }
+
+        int rc = zk->issueSync();
+        if (rc != ZOK) {
+            free(d);
+            METHOD_EPILOG(rc);
+            return;
+        }
+
+        METHOD_EPILOG(zoo_aget(zk->zhandle, *_path, watch, &data_completion, d));
+    }
+
+    int issueSync () {
+        int rc = zoo_async(zhandle, "/", &sync_completion, this);
+        if (rc == ZOK) {
+            sync_in_flight = true;
+            syncs_issued++;
+        }
+        return rc;
+    }
+
+    static void sync_completion (int rc, const char *value, const void *data) {
+        ZooKeeper *zk = (ZooKeeper *) data;
+        LOG_DEBUG(("sync completed rc=%d, rc_string=%s", rc, zerror(rc)));
+
+        zk->sync_in_flight = false;
+
+        struct sync_read *r = zk->sync_waiting_head;
+        zk->sync_waiting_head = zk->sync_waiting_tail = NULL;
+        if (r == NULL) {
+            return;
+        }
+
+        int sync_rc = zk->is_closed ? ZCLOSING : zk->issueSync();
+
+        while (r != NULL) {
+            struct sync_read *next = r->next;
+            int read_rc = sync_rc;
+            if (read_rc == ZOK) {
+                read_rc = zoo_aget(zk->zhandle, r->path, r->watch, &data_completion, r->read);
+            }
+            if (read_rc != ZOK) {
+                data_completion(read_rc, NULL, 0, NULL, r->read);
+            }
+            free(r->path);
+            free(r);
+            r = next;
+        }
+    }
+
+    static char *multiAlloc (struct multi_data *m, size_t len) {
+        char *p = (char *) malloc(len);
+        m->allocs[m->alloc_count++] = p;
+        return p;
+    }
+
+    // Copies a string or Buffer payload into memory owned by the multi.
+    // Sets *len to the payload length.
+    static char *multiCopyData (struct multi_data *m, Local<Value> v, int *len) {
+        if (v->IsUndefined() || v->IsNull()) {
+            *len = -1;
+            return NULL;
+        }
+        if (Buffer::HasInstance(v)) {
+            Local<Object> _data = v->ToObject();
+            *len = BufferLength(_data);
+            char *p = multiAlloc(m, *len > 0 ? *len : 1);
+            memcpy(p, BufferData(_data), *len);
+            return p;
+        }
+        Nan::Utf8String _data (v->ToString());
+        *len = _data.length();
+        char *p = multiAlloc(m, *len > 0 ? *len : 1);
+        memcpy(p, *_data, *len);
+        return p;
+    }
+
+    static void freeMultiData (struct multi_data *m) {
+        for (int i = 0; i < m->alloc_count; i++) {
+            free(m->allocs[i]);
+        }
+        for (int i = 0; i < m->count; i++) {
+            if (m->acls[i]) {
+                deallocate_ACL_vector(m->acls[i]);
+                free(m->acls[i]);
+            }
+        }
+        free(m->allocs);
+        free(m->acls);
+        free(m->ops);
+        free(m->results);
+        free(m->stats);
+        free(m);
+    }
+
+    static void multi_completion (int rc, const void *data) {
+        struct multi_data *m = (struct multi_data *) data;
+        void *cb = (void *) m->cb;
+
+        CALLBACK_PROLOG(3);
+        LOG_DEBUG(("rc=%d, rc_string=%s, ops=%d", rc, zerror(rc), m->count));
+
+        Local<Array> results = Nan::New<Array>((uint32_t) m->count);
+        for (int i = 0; i < m->count; i++) {
+            zoo_op_result_t *r = &m->results[i];
+            Local<Object> o = Nan::New<Object>();
+            Nan::Set(o, LOCAL_STRING("rc"), Nan::New<Int32>(r->err));
+            Nan::Set(o, LOCAL_STRING("error"), LOCAL_STRING(zk_error(r->err)));
+            if (r->err == ZOK && m->ops[i].type == ZOO_CREATE_OP && r->value) {
+                Nan::Set(o, LOCAL_STRING("path"), LOCAL_STRING(r->value));
+            }
+            if (r->err == ZOK && m->ops[i].type == ZOO_SETDATA_OP && r->stat) {
+                Nan::Set(o, LOCAL_STRING("stat"), zkk->createStatObject(r->stat));
+            }
+            results->Set(i, o);
+        }
+        argv[2] = results;
+
+        CALLBACK_EPILOG();
+        freeMultiData(m);
+    }
+
+    // a_multi([{ op: 'create'|'delete'|'set'|'check', path, data, flags, acl, version }, ...], cb(rc, error, results))
+    static void AMulti(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+        A_METHOD_PROLOG(2);
+
+        THROW_IF_NOT (info[0]->IsArray(), "a_multi: ops must be an array");
+        Local<Array> arr = Local<Array>::Cast(info[0]);
+        int count = arr->Length();
+
+        struct multi_data *m = (struct multi_data *) calloc(1, sizeof(struct multi_data));
+        m->cb = cb;
+        m->count = count;
+        m->ops = (zoo_op_t *) calloc(count > 0 ? count : 1, sizeof(zoo_op_t));
+        m->results = (zoo_op_result_t *) calloc(count > 0 ? count : 1, sizeof(zoo_op_result_t));
+        m->stats = (struct Stat *) calloc(count > 0 ? count : 1, sizeof(struct Stat));
+        m->allocs = (char **) calloc(count * 3 + 1, sizeof(char *));
+        m->acls = (struct ACL_vector **) calloc(count > 0 ? count : 1, sizeof(struct ACL_vector *));
+
+        for (int i = 0; i < count; i++) {
+            if (!arr->Get(i)->IsObject()) {
+                freeMultiData(m);
+                delete cb;
+                return Nan::ThrowError("a_multi: each op must be an object");
+            }
+            Local<Object> op = arr->Get(i)->ToObject();
+            Nan::Utf8String _type (op->Get(LOCAL_STRING("op"))->ToString());
+            PathArg _path (op->Get(LOCAL_STRING("path")));
+            char *path = multiAlloc(m, _path.length() + 1);
+            memcpy(path, *_path, _path.length() + 1);
+
+            Local<Value> v8version = op->Get(LOCAL_STRING("version"));
+            int32_t version = v8version->IsUndefined() ? -1 : v8version->Int32Value();
+
+            if (strcmp(*_type, "create") == 0) {
+                int len;
+                char *value = multiCopyData(m, op->Get(LOCAL_STRING("data")), &len);
+                uint32_t flags = op->Get(LOCAL_STRING("flags"))->Uint32Value();
+                const struct ACL_vector *acl = &ZOO_OPEN_ACL_UNSAFE;
+                Local<Value> v8acl = op->Get(LOCAL_STRING("acl"));
+                if (AclHandle::HasInstance(v8acl)) {
+                    acl = AclHandle::Vector(v8acl);
+                } else if (v8acl->IsArray()) {
+                    m->acls[i] = createAclVector(Local<Array>::Cast(v8acl));
+                    acl = m->acls[i];
+                }
+                char *path_buffer = multiAlloc(m, ZOOKEEPER_MAX_PATH_LENGTH);
+                zoo_create_op_init(&m->ops[i], path, value, len, acl, flags, path_buffer, ZOOKEEPER_MAX_PATH_LENGTH);
+            } else if (strcmp(*_type, "delete") == 0) {
+                zoo_delete_op_init(&m->ops[i], path, version);
+            } else if (strcmp(*_type, "set") == 0) {
+                int len;
+                char *value = multiCopyData(m, op->Get(LOCAL_STRING("data")), &len);
+                zoo_set_op_init(&m->ops[i], path, value, len, version, &m->stats[i]);
+            } else if (strcmp(*_type, "check") == 0) {
+                zoo_check_op_init(&m->ops[i], path, version);
+            } else {
+                freeMultiData(m);
+                delete cb;
+                return Nan::ThrowError("a_multi: op must be one of create, delete, set, check");
+            }
+        }
+
+        int ret = zoo_amulti(zk->zhandle, count, m->ops, m->results, &multi_completion, m);
+        if (ret != ZOK) {
+            freeMultiData(m);
+        }
+        zk->armDeadline(ret == ZOK ? cb : NULL);
+        RETURN_VALUE(info, Nan::New<Int32>(ret));
+    }
+
     static void AddAuth(const Nan::FunctionCallbackInfo<v8::Value>& info) {
         A_METHOD_PROLOG(3);
 
@@ -882,34 +3065,6 @@ public:
         return scope.Escape(arr);
     };
 
-    struct ACL_vector *createAclVector (Handle<Array> arr) {
-        Nan::HandleScope scope;
-
-        struct ACL_vector *aclv = (struct ACL_vector *) malloc(sizeof(struct ACL_vector));
-        aclv->count = arr->Length();
-        aclv->data = (struct ACL *) calloc(aclv->count, sizeof(struct ACL));
-
-        for (int i = 0, l = aclv->count; i < l; i++) {
-            Local<Object> obj = Local<Object>::Cast(arr->Get(i));
-
-            Nan::Utf8String _scheme (obj->Get(LOCAL_STRING("scheme"))->ToString());
-            Nan::Utf8String _auth (obj->Get(LOCAL_STRING("auth"))->ToString());
-            uint32_t _perms = obj->Get(LOCAL_STRING("perms"))->Uint32Value();
-
-            struct Id id;
-            struct ACL *acl = &aclv->data[i];
-
-            id.scheme = strdup(*_scheme);
-            id.id = strdup(*_auth);
-
-            acl->perms = _perms;
-            acl->id = id;
-        }
-
-
-        return aclv;
-    }
-
     static void acl_completion (int rc, struct ACL_vector *acl, struct Stat *stat, const void *cb) {
         LOG_DEBUG(("rc=%d, rc_string=%s, acl_vector=%lp", rc, zerror(rc), acl));
         CALLBACK_PROLOG(4);
@@ -955,6 +3110,72 @@ public:
         RETURN_VALUE(info, Nan::New<Integer> (zk->zhandle != 0 ? is_unrecoverable(zk->zhandle) : 0));
     }
 
+    static NAN_PROPERTY_GETTER(ServerPropertyGetter) {
+        ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());
+        assert(zk);
+        RETURN_VALUE(info, zk->connectedServer());
+    }
+
+    static NAN_PROPERTY_GETTER(ConnectionStatsPropertyGetter) {
+        ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());
+        assert(zk);
+        Local<Object> o = Nan::New<Object>();
+        Nan::Set(o, LOCAL_STRING("attempts"), Nan::New<Number>(zk->connect_attempts));
+        Nan::Set(o, LOCAL_STRING("connects"), Nan::New<Number>(zk->connects));
+        Nan::Set(o, LOCAL_STRING("disconnects"), Nan::New<Number>(zk->disconnects));
+        Nan::Set(o, LOCAL_STRING("last_backoff"), Nan::New<Number>(zk->last_backoff));
+        Nan::Set(o, LOCAL_STRING("server"), zk->connectedServer());
+        RETURN_VALUE(info, o);
+    }
+
+    static NAN_PROPERTY_GETTER(EventStatsPropertyGetter) {
+        ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());
+        assert(zk);
+        Local<Object> o = Nan::New<Object>();
+        Nan::Set(o, LOCAL_STRING("raw"), Nan::New<Number>(zk->events_raw));
+        Nan::Set(o, LOCAL_STRING("delivered"), Nan::New<Number>(zk->events_delivered));
+        Nan::Set(o, LOCAL_STRING("coalesced"), Nan::New<Number>(zk->events_raw - zk->events_delivered - zk->event_queued));
+        Nan::Set(o, LOCAL_STRING("queued"), Nan::New<Number>(zk->event_queued));
+        Nan::Set(o, LOCAL_STRING("batches"), Nan::New<Number>(zk->event_batches));
+        RETURN_VALUE(info, o);
+    }
+
+    static NAN_PROPERTY_GETTER(DeadlineStatsPropertyGetter) {
+        ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());
+        assert(zk);
+        Local<Object> o = Nan::New<Object>();
+        Nan::Set(o, LOCAL_STRING("pending"), Nan::New<Number>(zk->deadlines_pending));
+        Nan::Set(o, LOCAL_STRING("timed_out"), Nan::New<Number>(zk->ops_timed_out));
+        Nan::Set(o, LOCAL_STRING("cancelled"), Nan::New<Number>(zk->ops_cancelled));
+        Nan::Set(o, LOCAL_STRING("late"), Nan::New<Number>(zk->late_completions));
+        RETURN_VALUE(info, o);
+    }
+
+    static NAN_PROPERTY_GETTER(CompressionStatsPropertyGetter) {
+        ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());
+        assert(zk);
+        Local<Object> o = Nan::New<Object>();
+        Nan::Set(o, LOCAL_STRING("enabled"), Nan::New<Boolean>(zk->codec_enabled));
+        Nan::Set(o, LOCAL_STRING("writes"), Nan::New<Number>(zk->codec_writes));
+        Nan::Set(o, LOCAL_STRING("compressed"), Nan::New<Number>(zk->codec_compressed));
+        Nan::Set(o, LOCAL_STRING("bytes_in"), Nan::New<Number>(zk->codec_bytes_in));
+        Nan::Set(o, LOCAL_STRING("bytes_out"), Nan::New<Number>(zk->codec_bytes_out));
+        Nan::Set(o, LOCAL_STRING("ratio"), Nan::New<Number>(zk->codec_bytes_out ? (double) zk->codec_bytes_in / zk->codec_bytes_out : 0));
+        Nan::Set(o, LOCAL_STRING("reads"), Nan::New<Number>(zk->codec_reads));
+        Nan::Set(o, LOCAL_STRING("inflated"), Nan::New<Number>(zk->codec_inflated));
+        RETURN_VALUE(info, o);
+    }
+
+    static NAN_PROPERTY_GETTER(SyncStatsPropertyGetter) {
+        ZooKeeper *zk = ObjectWrap::Unwrap<ZooKeeper>(info.This());
+        assert(zk);
+        Local<Object> o = Nan::New<Object>();
+        Nan::Set(o, LOCAL_STRING("reads"), Nan::New<Number>(zk->sync_reads));
+        Nan::Set(o, LOCAL_STRING("syncs"), Nan::New<Number>(zk->syncs_issued));
+        Nan::Set(o, LOCAL_STRING("saved"), Nan::New<Number>(zk->sync_reads > zk->syncs_issued ? zk->sync_reads - zk->syncs_issued : 0));
+        RETURN_VALUE(info, o);
+    }
+
     void realClose (int code) {
         if (is_closed) {
             return;
@@ -971,6 +3192,39 @@ public:
             zookeeper_close(zhandle);
             zhandle = 0;
 
+            while (child_watches) {
+                unlinkChildWatch(child_watches);
+            }
+
+            // in-flight walk requests completed with ZCLOSING above and
+            // ended their walks; paused ones are ended here. A walk whose
+            // completion or end delivery is running right now (close called
+            // from its callback) holds an in_flight reference and is freed
+            // when that returns.
+            struct subtree_walk *next;
+            for (struct subtree_walk *w = walks; w; w = next) {
+                next = w->next;
+                if (!w->cancelled) {
+                    w->cancelled = true;
+                    walkDeliver(w, ZCLOSING, NULL, NULL, NULL, 0);
+                }
+                if (w->in_flight == 0) {
+                    freeWalk(w);
+                }
+            }
+
+            // zookeeper_close completed every request above
+            freeDeadlines();
+
+            if (event_timer) {
+                dropEvents();
+                uv_timer_stop(event_timer);
+                uv_close((uv_handle_t *) event_timer, delete_on_close);
+                event_timer = NULL;
+                free(event_buckets);
+                event_buckets = NULL;
+            }
+
             LOG_DEBUG(("zookeeper_close() returned"));
 
             if (zk_io) {
@@ -1005,6 +3259,10 @@ public:
     virtual ~ZooKeeper() {
         //realClose ();
         LOG_INFO(("ZooKeeper destructor invoked"));
+        for (int i = 0; i < codec_path_count; i++) {
+            free(codec_paths[i]);
+        }
+        free(codec_paths);
     }
 
 
@@ -1013,6 +3271,35 @@ public:
         ZERO_MEM (zk_io);
         ZERO_MEM (zk_timer);
         is_closed = false;
+        sync_in_flight = false;
+        sync_waiting_head = sync_waiting_tail = NULL;
+        sync_reads = syncs_issued = 0;
+        child_watches = NULL;
+        walks = NULL;
+        walk_last_id = 0;
+        coalesce_window = 0;
+        coalesce_max = 1000;
+        event_timer = NULL;
+        event_buckets = NULL;
+        event_head = event_tail = NULL;
+        event_queued = 0;
+        events_raw = events_delivered = event_batches = 0;
+        codec_enabled = false;
+        codec_paths = NULL;
+        codec_path_count = 0;
+        codec_writes = codec_compressed = codec_bytes_in = codec_bytes_out = 0;
+        codec_reads = codec_inflated = 0;
+        deterministic_order = false;
+        readonly = false;
+        backoff_base = backoff_max = 0;
+        backoff_attempt = 0;
+        reconnect_at = last_backoff = 0;
+        connect_attempts = connects = disconnects = 0;
+        op_timeout = next_op_timeout = next_op_token = 0;
+        deadline_slots = deadline_buckets = NULL;
+        wheel_time = 0;
+        deadlines_pending = deadlines_timed = 0;
+        ops_timed_out = ops_cancelled = late_completions = 0;
     }
 private:
     zhandle_t *zhandle;
@@ -1025,24 +3312,90 @@ private:
     timeval tv;
     int64_t last_activity; // time of last zookeeper event loop activity
     bool is_closed;
+
+    bool sync_in_flight;
+    struct sync_read *sync_waiting_head;
+    struct sync_read *sync_waiting_tail;
+    uint64_t sync_reads;   // linearizable reads requested
+    uint64_t syncs_issued; // zoo_async calls actually sent
+
+    struct child_watch *child_watches;
+
+    struct subtree_walk *walks;
+    int32_t walk_last_id;
+
+    uint32_t coalesce_window;   // ms to hold watch events for, 0 delivers them at once
+    uint32_t coalesce_max;      // events delivered per loop iteration
+    uv_timer_t *event_timer;
+    struct queued_event **event_buckets;
+    struct queued_event *event_head;
+    struct queued_event *event_tail;
+    uint64_t event_queued;
+    uint64_t events_raw;        // events received from the C client
+    uint64_t events_delivered;  // events passed on to JS
+    uint64_t event_batches;
+
+    bool codec_enabled;
+    int32_t codec_threshold;  // payloads smaller than this are sent raw
+    int codec_level;
+    uint32_t codec_offload;   // inflate payloads at least this big off the main thread
+    char **codec_paths;       // path prefixes to compress under, all paths if empty
+    int codec_path_count;
+    uint64_t codec_writes;    // writes selected by the policy
+    uint64_t codec_compressed;
+    uint64_t codec_bytes_in;
+    uint64_t codec_bytes_out;
+    uint64_t codec_reads;     // reads that found a compressed payload
+    uint64_t codec_inflated;
+
+    bool deterministic_order;
+    bool readonly;            // open sessions that may attach to read-only servers
+    uint32_t backoff_base;    // reconnect backoff, 0 to reconnect immediately
+    uint32_t backoff_max;
+    int backoff_attempt;
+    int64_t reconnect_at;     // loop time before which no reconnect is attempted
+    int64_t last_backoff;
+    uint64_t connect_attempts;
+    uint64_t connects;
+    uint64_t disconnects;
+
+    uint32_t op_timeout;        // deadline in ms for every request, 0 for none
+    uint32_t next_op_timeout;   // set_next_op, for the next request only
+    uint32_t next_op_token;
+    struct op_deadline **deadline_slots;    // the timer wheel
+    struct op_deadline **deadline_buckets;  // every entry, by callback
+    int64_t wheel_time;         // loop time the wheel was last advanced to
+    uint32_t deadlines_pending; // entries in deadline_buckets
+    uint32_t deadlines_timed;   // entries in deadline_slots
+    uint64_t ops_timed_out;
+    uint64_t ops_cancelled;
+    uint64_t late_completions;  // completions swallowed after an answer
 };
 
 } // namespace "zk"
 
 extern "C" void init(Handle<Object> target) {
+    // reconnect jitter must differ between the processes of a fleet
+    srandom((unsigned) (uv_hrtime() ^ getpid()));
+
     INITIALIZE_STRING (zk::on_closed,            "close");
     INITIALIZE_STRING (zk::on_connected,         "connect");
     INITIALIZE_STRING (zk::on_connecting,        "connecting");
+    INITIALIZE_STRING (zk::on_readonly,          "readonly");
     INITIALIZE_STRING (zk::on_event_created,     "created");
     INITIALIZE_STRING (zk::on_event_deleted,     "deleted");
     INITIALIZE_STRING (zk::on_event_changed,     "changed");
     INITIALIZE_STRING (zk::on_event_child,       "child");
     INITIALIZE_STRING (zk::on_event_notwatching, "notwatching");
+    INITIALIZE_STRING (zk::on_event_batch,       "batch");
 
     INITIALIZE_SYMBOL (zk::PRIVATE_PROP_ZK);
     INITIALIZE_SYMBOL (zk::PRIVATE_PROP_HANDBACK);
 
     zk::ZooKeeper::Initialize(target);
+    zk::AclHandle::Initialize(target);
+    zk::PathHandle::Initialize(target);
+    zk::SharedConfig::Initialize(target);
 }
 
 NODE_MODULE(zookeeper, init)
@@ -0,0 +1,90 @@
+#ifndef ZK_CODEC_H_
+#define ZK_CODEC_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <zlib.h>
+
+/*
+ * Compressed payload layout:
+ *
+ *   byte 0..3   magic 0xFA 'Z' 'K' 0x01 (0xFA never starts valid UTF-8, so
+ *               plain text and JSON payloads cannot be mistaken for it)
+ *   byte 4..7   uncompressed length, big endian
+ *   byte 8..    zlib stream
+ *
+ * Anything without the magic is returned as-is, so data written before
+ * compression was enabled (or by other clients) still reads.
+ */
+
+#define ZK_CODEC_HEADER_SIZE 8
+
+// deflate cannot shrink data by more than about 1032:1, and the server
+// refuses znodes above jute.maxbuffer (1 MB unless raised), so a header
+// claiming more than that is corrupt or hostile
+#define ZK_CODEC_MAX_RATIO 1032
+#ifndef ZK_CODEC_MAX_ZNODE
+#define ZK_CODEC_MAX_ZNODE (1024 * 1024)
+#endif
+#define ZK_CODEC_MAX_ORIGINAL ((uint64_t) ZK_CODEC_MAX_ZNODE * ZK_CODEC_MAX_RATIO)
+
+static const unsigned char zk_codec_magic[4] = { 0xFA, 'Z', 'K', 0x01 };
+
+static inline int zk_codec_is_encoded(const char *data, int len) {
+    return data != NULL && len >= ZK_CODEC_HEADER_SIZE && memcmp(data, zk_codec_magic, 4) == 0;
+}
+
+static inline uint32_t zk_codec_original_length(const char *data) {
+    const unsigned char *p = (const unsigned char *) data + 4;
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+// Returns a malloc'd encoded copy of data in *out, or 0 when compression
+// would not make the payload smaller (the caller then sends it raw).
+static inline int zk_codec_compress(const char *data, int len, int level, char **out, int *out_len) {
+    uLongf bound = compressBound((uLong) len);
+    char *buf = (char *) malloc(ZK_CODEC_HEADER_SIZE + bound);
+    if (buf == NULL) {
+        return 0;
+    }
+    if (compress2((Bytef *) buf + ZK_CODEC_HEADER_SIZE, &bound, (const Bytef *) data, (uLong) len, level) != Z_OK ||
+            ZK_CODEC_HEADER_SIZE + bound >= (uLongf) len) {
+        free(buf);
+        return 0;
+    }
+    memcpy(buf, zk_codec_magic, 4);
+    buf[4] = (char) ((len >> 24) & 0xff);
+    buf[5] = (char) ((len >> 16) & 0xff);
+    buf[6] = (char) ((len >> 8) & 0xff);
+    buf[7] = (char) (len & 0xff);
+    *out = buf;
+    *out_len = (int) (ZK_CODEC_HEADER_SIZE + bound);
+    return 1;
+}
+
+// Inflates an encoded payload into a malloc'd buffer. Returns 0 if the
+// stream is corrupt or does not match the length in its header, and before
+// allocating anything if that length is more than the stream can hold.
+static inline int zk_codec_decompress(const char *data, int len, char **out, int *out_len) {
+    uLongf n = zk_codec_original_length(data);
+    if ((uint64_t) n > ZK_CODEC_MAX_ORIGINAL || (uint64_t) n > (uint64_t) (len - ZK_CODEC_HEADER_SIZE) * ZK_CODEC_MAX_RATIO ||
+            n > (uLongf) INT32_MAX) {
+        return 0;
+    }
+    char *buf = (char *) malloc(n > 0 ? n : 1);
+    if (buf == NULL) {
+        return 0;
+    }
+    uLongf expected = n;
+    if (uncompress((Bytef *) buf, &n, (const Bytef *) data + ZK_CODEC_HEADER_SIZE, (uLong) (len - ZK_CODEC_HEADER_SIZE)) != Z_OK ||
+            n != expected) {
+        free(buf);
+        return 0;
+    }
+    *out = buf;
+    *out_len = (int) n;
+    return 1;
+}
+
+#endif /*ZK_CODEC_H_*/
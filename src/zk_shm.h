@@ -0,0 +1,374 @@
+#ifndef ZK_SHM_H_
+#define ZK_SHM_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Shared config file: a snapshot of a subtree that one publisher keeps
+ * current and any number of processes on the host read without a session.
+ * The file is host byte order, it never leaves the host:
+ *
+ *   header   struct zk_shm_header, 64 bytes
+ *   index    count x struct zk_shm_entry, sorted by path in memcmp order
+ *   data     the paths and values the index points at
+ *
+ * The publisher rewrites the file in place under a seqlock. seq is odd
+ * while a publish is in progress and even otherwise. A reader copies what
+ * it needs between two reads of seq, and retries if they differ or are
+ * odd. Readers take no lock and never hold up the publisher. After
+ * ZK_SHM_MAX_RETRIES a lookup gives up with EAGAIN instead of spinning.
+ * Every offset read inside the section is bounds-checked first, because
+ * the bytes may be mid-rewrite. The file only grows. A reader whose mapping
+ * is smaller than header.size maps the file again.
+ *
+ * A publisher holds an exclusive flock on the file, so a second publisher
+ * fails to open it with EWOULDBLOCK. A publisher that died mid-publish
+ * leaves seq odd. The next one finds the snapshot torn on open, empties
+ * it and makes seq even again. Readers then see no paths until its first
+ * publish.
+ *
+ * This header is all a C reader needs: zk_shm_open(&m, file, 0), then
+ * zk_shm_get(&m, path, len, &value, &value_len, &generation).
+ */
+
+#define ZK_SHM_MAGIC 0x4d534b5a     /* "ZKSM" */
+#define ZK_SHM_VERSION 1
+#define ZK_SHM_MIN_SIZE 65536
+#define ZK_SHM_MAX_RETRIES 100000
+
+struct zk_shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t seq;
+    uint64_t generation;            /* publishes so far */
+    uint64_t size;                  /* file size */
+    uint64_t max_zxid;              /* highest mzxid in the snapshot */
+    uint32_t count;
+    uint32_t reserved[5];
+};
+
+struct zk_shm_entry {
+    uint64_t path_off;
+    uint64_t value_off;
+    uint64_t mzxid;
+    uint32_t path_len;
+    uint32_t value_len;
+    int32_t version;
+    uint32_t reserved;
+};
+
+/* a znode handed to zk_shm_publish */
+struct zk_shm_record {
+    const char *path;
+    uint32_t path_len;
+    const char *value;
+    uint32_t value_len;
+    uint64_t mzxid;
+    int32_t version;
+};
+
+typedef struct zk_shm {
+    int fd;
+    int writable;
+    char *base;
+    size_t size;
+} zk_shm_t;
+
+static inline struct zk_shm_header *zk_shm_hdr(const zk_shm_t *m) {
+    return (struct zk_shm_header *) m->base;
+}
+
+static inline int zk_shm_map(zk_shm_t *m, size_t size) {
+    void *p = mmap(NULL, size, m->writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, m->fd, 0);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+    m->base = (char *) p;
+    m->size = size;
+    return 0;
+}
+
+/* Opens (a publisher: creates) the file. Returns 0, or -1 with errno set. */
+static inline int zk_shm_open(zk_shm_t *m, const char *file, int writable) {
+    struct stat st;
+    m->base = NULL;
+    m->size = 0;
+    m->writable = writable;
+    m->fd = open(file, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (m->fd < 0) {
+        return -1;
+    }
+    if (writable && flock(m->fd, LOCK_EX | LOCK_NB) < 0) {
+        goto fail;
+    }
+    if (fstat(m->fd, &st) < 0) {
+        goto fail;
+    }
+    if (writable && (size_t) st.st_size < sizeof(struct zk_shm_header)) {
+        if (ftruncate(m->fd, ZK_SHM_MIN_SIZE) < 0) {
+            goto fail;
+        }
+        st.st_size = ZK_SHM_MIN_SIZE;
+    }
+    if ((size_t) st.st_size < sizeof(struct zk_shm_header)) {
+        errno = EINVAL;
+        goto fail;
+    }
+    if (zk_shm_map(m, (size_t) st.st_size) < 0) {
+        goto fail;
+    }
+    if (writable && zk_shm_hdr(m)->magic != ZK_SHM_MAGIC) {
+        memset(m->base, 0, sizeof(struct zk_shm_header));
+        zk_shm_hdr(m)->version = ZK_SHM_VERSION;
+        zk_shm_hdr(m)->size = m->size;
+        __atomic_store_n(&zk_shm_hdr(m)->magic, ZK_SHM_MAGIC, __ATOMIC_RELEASE);
+    }
+    if (zk_shm_hdr(m)->magic != ZK_SHM_MAGIC || zk_shm_hdr(m)->version != ZK_SHM_VERSION) {
+        munmap(m->base, m->size);
+        m->base = NULL;
+        errno = EINVAL;
+        goto fail;
+    }
+    if (writable && (zk_shm_hdr(m)->seq & 1)) {
+        /* the last publisher died mid-publish: drop the torn snapshot */
+        struct zk_shm_header *h = zk_shm_hdr(m);
+        h->count = 0;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELEASE);
+    }
+    return 0;
+fail:
+    close(m->fd);
+    m->fd = -1;
+    return -1;
+}
+
+static inline void zk_shm_close(zk_shm_t *m) {
+    if (m->base) {
+        munmap(m->base, m->size);
+        m->base = NULL;
+    }
+    if (m->fd >= 0) {
+        close(m->fd);
+        m->fd = -1;
+    }
+}
+
+/* Maps the file again if the publisher has grown it. */
+static inline int zk_shm_refresh(zk_shm_t *m) {
+    struct stat st;
+    if (__atomic_load_n(&zk_shm_hdr(m)->size, __ATOMIC_ACQUIRE) <= m->size) {
+        return 0;
+    }
+    if (fstat(m->fd, &st) < 0) {
+        return -1;
+    }
+    munmap(m->base, m->size);
+    m->base = NULL;
+    return zk_shm_map(m, (size_t) st.st_size);
+}
+
+static int zk_shm_record_cmp(const void *a, const void *b) {
+    const struct zk_shm_record *x = (const struct zk_shm_record *) a;
+    const struct zk_shm_record *y = (const struct zk_shm_record *) b;
+    uint32_t n = x->path_len < y->path_len ? x->path_len : y->path_len;
+    int c = memcmp(x->path, y->path, n);
+    if (c != 0) {
+        return c;
+    }
+    return x->path_len < y->path_len ? -1 : x->path_len > y->path_len;
+}
+
+/* Replaces the snapshot with records (sorted here). Returns 0 or -1. */
+static inline int zk_shm_publish(zk_shm_t *m, struct zk_shm_record *records, uint32_t count) {
+    size_t need = sizeof(struct zk_shm_header) + (size_t) count * sizeof(struct zk_shm_entry);
+    uint64_t max_zxid = 0;
+    uint32_t i;
+    qsort(records, count, sizeof(struct zk_shm_record), zk_shm_record_cmp);
+    for (i = 0; i < count; i++) {
+        need += records[i].path_len + records[i].value_len;
+        if (records[i].mzxid > max_zxid) {
+            max_zxid = records[i].mzxid;
+        }
+    }
+    if (need > m->size) {
+        size_t size = m->size * 2 > need ? m->size * 2 : need;
+        size = (size + 4095) & ~(size_t) 4095;
+        if (ftruncate(m->fd, (off_t) size) < 0) {
+            return -1;
+        }
+        munmap(m->base, m->size);
+        m->base = NULL;
+        if (zk_shm_map(m, size) < 0) {
+            return -1;
+        }
+    }
+
+    struct zk_shm_header *h = zk_shm_hdr(m);
+    struct zk_shm_entry *index = (struct zk_shm_entry *) (m->base + sizeof(struct zk_shm_header));
+    uint64_t off = sizeof(struct zk_shm_header) + (uint64_t) count * sizeof(struct zk_shm_entry);
+    uint64_t seq = h->seq | 1;
+
+    __atomic_store_n(&h->seq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (i = 0; i < count; i++) {
+        struct zk_shm_entry *e = &index[i];
+        e->path_off = off;
+        e->path_len = records[i].path_len;
+        memcpy(m->base + off, records[i].path, records[i].path_len);
+        off += records[i].path_len;
+        e->value_off = off;
+        e->value_len = records[i].value_len;
+        if (records[i].value_len) {
+            memcpy(m->base + off, records[i].value, records[i].value_len);
+        }
+        off += records[i].value_len;
+        e->mzxid = records[i].mzxid;
+        e->version = records[i].version;
+        e->reserved = 0;
+    }
+    h->count = count;
+    h->generation++;
+    h->max_zxid = max_zxid;
+    __atomic_store_n(&h->size, (uint64_t) m->size, __ATOMIC_RELAXED);
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&h->seq, seq + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Binary search inside a read section; every offset is checked. */
+static inline const struct zk_shm_entry *zk_shm_find(const zk_shm_t *m, const char *path, uint32_t path_len) {
+    const struct zk_shm_header *h = zk_shm_hdr(m);
+    uint32_t count = h->count;
+    if (sizeof(struct zk_shm_header) + (size_t) count * sizeof(struct zk_shm_entry) > m->size) {
+        return NULL;
+    }
+    const struct zk_shm_entry *index = (const struct zk_shm_entry *) (m->base + sizeof(struct zk_shm_header));
+    uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const struct zk_shm_entry *e = &index[mid];
+        if (e->path_off > m->size || e->path_len > m->size - e->path_off) {
+            return NULL;
+        }
+        uint32_t n = e->path_len < path_len ? e->path_len : path_len;
+        int c = memcmp(m->base + e->path_off, path, n);
+        if (c == 0) {
+            c = e->path_len < path_len ? -1 : e->path_len > path_len;
+        }
+        if (c == 0) {
+            return e;
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Looks path up. Returns 1 with a malloc'd copy of the value in *value
+ * (free it), 0 if the path is not in the snapshot, -1 on error (errno is
+ * EAGAIN when no consistent snapshot was seen in ZK_SHM_MAX_RETRIES tries).
+ * generation, if not NULL, gets the publish the answer came from.
+ */
+static inline int zk_shm_get(zk_shm_t *m, const char *path, uint32_t path_len, char **value, uint32_t *value_len, uint64_t *generation) {
+    char *buf = NULL;
+    uint32_t cap = 0;
+    int spins = 0;
+    for (;;) {
+        if (spins++ >= ZK_SHM_MAX_RETRIES) {
+            free(buf);
+            errno = EAGAIN;
+            return -1;
+        }
+        if (spins % 64 == 0) {
+            sched_yield();
+        }
+        if (zk_shm_refresh(m) < 0) {
+            free(buf);
+            return -1;
+        }
+        const struct zk_shm_header *h = zk_shm_hdr(m);
+        uint64_t s1 = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1) {
+            continue;
+        }
+        int found = 0;
+        uint32_t len = 0;
+        uint64_t gen = h->generation;
+        const struct zk_shm_entry *e = zk_shm_find(m, path, path_len);
+        if (e) {
+            uint64_t off = e->value_off;
+            len = e->value_len;
+            if (off <= m->size && len <= m->size - off) {
+                if (len > cap) {
+                    char *p = (char *) realloc(buf, len);
+                    if (!p) {
+                        free(buf);
+                        return -1;
+                    }
+                    buf = p;
+                    cap = len;
+                }
+                memcpy(buf, m->base + off, len);
+                found = 1;
+            }
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&h->seq, __ATOMIC_RELAXED) != s1) {
+            continue;
+        }
+        if (e && !found) {
+            /* a consistent entry outside our mapping: the file grew */
+            continue;
+        }
+        if (generation) {
+            *generation = gen;
+        }
+        if (!found) {
+            free(buf);
+            return 0;
+        }
+        if (!buf) {
+            buf = (char *) malloc(1);
+        }
+        *value = buf;
+        *value_len = len;
+        return 1;
+    }
+}
+
+/*
+ * The generation of the current snapshot, 0 before the first publish.
+ * Without a consistent read in ZK_SHM_MAX_RETRIES tries, the generation
+ * of the publish in progress.
+ */
+static inline uint64_t zk_shm_generation(const zk_shm_t *m) {
+    const struct zk_shm_header *h = zk_shm_hdr(m);
+    for (int tries = 0; tries < ZK_SHM_MAX_RETRIES; tries++) {
+        uint64_t s1 = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+        uint64_t gen = h->generation;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (!(s1 & 1) && __atomic_load_n(&h->seq, __ATOMIC_RELAXED) == s1) {
+            return gen;
+        }
+        sched_yield();
+    }
+    return h->generation;
+}
+
+#endif
@@ -0,0 +1,35 @@
+var assert = require('assert');
+var ZK = require ("../lib/zookeeper");
+
+var connect  = (process.argv[2] || 'localhost:2181');
+
+var acl = ZK.acl([ZK.ZOO_READ_ACL_UNSAFE]);
+assert.equal(acl.length, 1);
+
+var zk = new ZK();
+zk.connect({connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false}, function (err) {
+    if(err) throw err;
+    zk.a_create ("/node.js-acl", "", ZK.ZOO_SEQUENCE | ZK.ZOO_EPHEMERAL, acl, function (rc, error, path) {
+        assert.equal(rc, 0, error);
+        zk.a_get_acl (path, function (rc, error, list, stat) {
+            assert.equal(rc, 0, error);
+            assert.equal(list.length, 1);
+            assert.equal(list[0].perms, ZK.ZOO_PERM_READ);
+            // the node is read-only for everyone now
+            zk.a_set (path, "x", -1, function (rc, error, stat) {
+                assert.equal(rc, ZK.ZNOAUTH);
+                zk.a_multi ([{op: 'create', path: path + "-multi", data: "", flags: ZK.ZOO_EPHEMERAL, acl: acl}], function (rc, error, results) {
+                    assert.equal(rc, 0, error);
+                    zk.a_get_acl (path + "-multi", function (rc, error, list) {
+                        assert.equal(rc, 0, error);
+                        assert.equal(list[0].perms, ZK.ZOO_PERM_READ);
+                        console.log ("TEST PASSED!", __filename);
+                        process.nextTick(function () {
+                            zk.close ();
+                        });
+                    });
+                });
+            });
+        });
+    });
+});
@@ -0,0 +1,34 @@
+var assert = require('assert');
+var ZK = require ("../lib/zookeeper");
+
+var N = parseInt (process.argv[2] || 5);
+var connect  = (process.argv[3] || 'localhost:2181');
+
+var zk = new ZK();
+zk.connect({connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false,
+            event_coalescing: {window: 500}}, function (err) {
+    if(err) throw err;
+    zk.a_create ("/node.js-coalescing", "", ZK.ZOO_SEQUENCE | ZK.ZOO_EPHEMERAL, function (rc, error, path) {
+        assert.equal(rc, 0, error);
+        zk.on('batch', function (events) {
+            var changed = events.filter(function (e) { return e.type === 'changed' && e.path === path; });
+            assert.equal(changed.length, 1, "repeated events were not coalesced");
+            var stats = zk.event_stats;
+            console.log ("event stats: %j", stats);
+            assert.ok(stats.coalesced >= N - 1);
+            console.log ("TEST PASSED!", __filename);
+            process.nextTick(function () {
+                zk.close ();
+            });
+        });
+        // each exists watch is set again and fired again within the window
+        for (var i = 0; i < N; i++) {
+            zk.a_exists (path, true, function (rc, error) {
+                assert.equal(rc, 0, error);
+            });
+            zk.a_set (path, "v" + i, -1, function (rc, error) {
+                assert.equal(rc, 0, error);
+            });
+        }
+    });
+});
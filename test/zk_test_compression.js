@@ -0,0 +1,47 @@
+var assert = require('assert');
+var ZK = require ("../lib/zookeeper");
+
+var connect  = (process.argv[2] || 'localhost:2181');
+
+var config = {connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false};
+var value = JSON.stringify({ routes: new Array(2000).join('{"host":"10.0.0.1","weight":1},') });
+
+var plain = new ZK();
+var zk = new ZK();
+zk.connect({connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false, compression:{threshold:256}}, function (err) {
+    if(err) throw err;
+    zk.a_create ("/node.js-compressed", value, ZK.ZOO_SEQUENCE | ZK.ZOO_EPHEMERAL, function (rc, error, path) {
+        assert.equal(rc, 0, error);
+        zk.a_get (path, false, function (rc, error, stat, data) {
+            assert.equal(rc, 0, error);
+            assert.equal(data.toString(), value);
+            assert.ok(stat.dataLength < value.length, "payload was not compressed");
+            var stats = zk.compression_stats;
+            console.log ("compression stats: %j", stats);
+            assert.equal(stats.compressed, 1);
+            assert.equal(stats.inflated, 1);
+            // a handle without the codec sees the encoded bytes
+            plain.connect(config, function (err) {
+                if(err) throw err;
+                plain.a_get (path, false, function (rc, error, stat, data) {
+                    assert.equal(rc, 0, error);
+                    assert.equal(data[0], 0xFA);
+                    // a header claiming 4 GB in a few bytes is not inflated
+                    var forged = Buffer.concat([new Buffer([0xFA, 0x5A, 0x4B, 0x01, 0xFF, 0xFF, 0xFF, 0xFF]), new Buffer("xxxxxxxxxxxxxxxx")]);
+                    plain.a_set (path, forged, -1, function (rc, error) {
+                        assert.equal(rc, 0, error);
+                        zk.a_get (path, false, function (rc, error, stat, data) {
+                            assert.equal(rc, 0, error);
+                            assert.equal(data.toString('hex'), forged.toString('hex'));
+                            console.log ("TEST PASSED!", __filename);
+                            process.nextTick(function () {
+                                plain.close ();
+                                zk.close ();
+                            });
+                        });
+                    });
+                });
+            });
+        });
+    });
+});
@@ -0,0 +1,64 @@
+var assert = require('assert');
+var net = require('net');
+var ZK = require ("../lib/zookeeper");
+
+var connect  = (process.argv[2] || 'localhost:2181');
+
+var zk = new ZK();
+zk.connect({connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false}, function (err) {
+    if(err) throw err;
+    var token = new ZK.CancelToken();
+    var calls = 0;
+    zk.with_deadline(0, token).a_get ("/", false, function (rc, error) {
+        calls++;
+        assert.equal(rc, ZK.ZCANCELLED, error);
+    });
+    // nothing can have completed before this runs
+    assert.equal(token.cancel(), 1);
+    zk.with_deadline(0, token).a_exists ("/", false, function (rc) {
+        assert.equal(rc, ZK.ZCANCELLED);
+        // the real answer to the cancelled a_get arrives but is dropped
+        zk.a_sync ("/", function (rc, error) {
+            assert.equal(rc, 0, error);
+            assert.equal(calls, 1);
+            assert.equal(zk.deadline_stats.cancelled, 1);
+            assert.equal(zk.deadline_stats.late, 1);
+            expire();
+        });
+    });
+});
+
+// A stand-in server that accepts connections and never answers: the
+// request cannot complete before its deadline, however slow the machine.
+function expire() {
+    var sockets = [];
+    var server = net.createServer(function (socket) {
+        sockets.push(socket);
+    });
+    server.listen(0, '127.0.0.1', function () {
+        var stalled = new ZK();
+        stalled.init({connect:'127.0.0.1:' + server.address().port, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_ERROR, host_order_deterministic:false});
+        var calls = 0, start = Date.now();
+        stalled.with_deadline(50).a_get ("/", false, function (rc, error) {
+            calls++;
+            assert.equal(rc, ZK.ZOPERATIONTIMEOUT, error);
+            assert.ok(Date.now() - start >= 45, "expired after " + (Date.now() - start) + " ms");
+            assert.equal(stalled.deadline_stats.timed_out, 1);
+            assert.equal(stalled.deadline_stats.pending, 0);
+            process.nextTick(function () {
+                // the request is failed again by the close, and dropped
+                stalled.close ();
+                assert.equal(calls, 1);
+                sockets.forEach(function (socket) { socket.destroy(); });
+                server.close();
+                zk.with_deadline(1000).a_exists ("/", false, function (rc, error) {
+                    assert.equal(rc, 0, error);
+                    console.log ("TEST PASSED!", __filename);
+                    process.nextTick(function () {
+                        zk.close ();
+                    });
+                });
+            });
+        });
+    });
+}
@@ -0,0 +1,79 @@
+var assert = require('assert');
+var ZK = require ("../lib/zookeeper");
+
+var connect  = (process.argv[2] || 'localhost:2181');
+
+var zk = new ZK();
+zk.connect({connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false}, function (err) {
+    if(err) throw err;
+    var str = '{"name":"½ + ¼","n":3}';
+    zk.a_create ("/node.js-encoding", str, ZK.ZOO_SEQUENCE | ZK.ZOO_EPHEMERAL, function (rc, error, path) {
+        assert.equal(rc, 0, error);
+        zk.setEncoding('utf8');
+        zk.a_get (path, false, function (rc, error, stat, data) {
+            assert.equal(rc, 0, error);
+            assert.strictEqual(data, str);
+            zk.a_get (path, { encoding: 'json' }, function (rc, error, stat, data) {
+                assert.equal(rc, 0, error);
+                assert.deepEqual(data, { name: '½ + ¼', n: 3 });
+                zk.a_get (path, { encoding: 'hex' }, function (rc, error, stat, data) {
+                    assert.equal(rc, 0, error);
+                    assert.equal(data, new Buffer(str, 'utf8').toString('hex'));
+                    zk.a_get (path, { encoding: null }, function (rc, error, stat, data) {
+                        assert.equal(rc, 0, error);
+                        assert.ok(Buffer.isBuffer(data));
+                        zk.setEncoding('json');
+                        zk.a_set (path, "not json", -1, function (rc, error) {
+                            assert.equal(rc, 0, error);
+                            zk.aw_get (path, function () {}, function (rc, error, stat, data) {
+                                assert.equal(rc, ZK.ZMARSHALLINGERROR);
+                                assert.equal(data.toString(), "not json");
+                                zk.a_set (path, "", -1, function (rc, error) {
+                                    assert.equal(rc, 0, error);
+                                    zk.a_get (path, false, function (rc, error, stat, data) {
+                                        assert.equal(rc, 0, error);
+                                        assert.strictEqual(data, null);
+                                        reuse(path);
+                                    });
+                                });
+                            });
+                        });
+                    });
+                });
+            });
+        });
+    });
+});
+
+// one callback for reads in different encodings, concurrent and in turn:
+// each read is decoded as it asked
+function reuse(path) {
+    var expected = [];
+    function got(rc, error, stat, data) {
+        assert.equal(rc, 0, error);
+        var e = expected.shift();
+        if(e === 'buffer') {
+            assert.ok(Buffer.isBuffer(data));
+            assert.equal(data.toString(), "abc");
+        } else {
+            assert.strictEqual(data, e);
+        }
+        if(expected.length === 2) {
+            zk.setEncoding('utf8');
+            zk.a_get (path, false, got);
+            zk.setEncoding(null);
+            zk.a_get (path, false, got);
+        } else if(expected.length === 0) {
+            console.log ("TEST PASSED!", __filename);
+            process.nextTick(function () {
+                zk.close ();
+            });
+        }
+    }
+    zk.a_set (path, "abc", -1, function (rc, error) {
+        assert.equal(rc, 0, error);
+        expected = ["616263", 'buffer', "abc", 'buffer'];
+        zk.a_get (path, { encoding: 'hex' }, got);
+        zk.a_get (path, { encoding: null }, got);
+    });
+}
@@ -0,0 +1,43 @@
+var assert = require('assert');
+var ZK = require ("../lib/zookeeper");
+
+var N = parseInt (process.argv[2] || 100);
+var connect  = (process.argv[3] || 'localhost:2181');
+var options = {connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false};
+
+var zk1 = new ZK(), zk2 = new ZK();
+zk1.connect(options, function (err) {
+    if(err) throw err;
+    zk2.connect(options, function (err) {
+        if(err) throw err;
+        // a zero delay hedges every read that is not answered at once
+        var reads = ZK.hedge(zk1, zk2, {delay: 0});
+        var done = 0;
+        for (var i = 0; i < N; i++) {
+            reads.a_exists ("/", function (rc, error, stat) {
+                assert.equal(rc, 0, error);
+                assert.ok(stat);
+                // each read calls back once, whichever session answers
+                assert.ok(++done <= N, "a read called back twice");
+                if (done < N) return;
+                var s = reads.stats;
+                assert.equal(s.reads, N);
+                assert.equal(s.primary_wins + s.secondary_wins, N);
+                assert.ok(s.hedged > 0, "no read was hedged");
+                assert.ok(s.hedged <= N);
+                var missing = 0;
+                // the losers of the reads above answer before this one on
+                // either session, so a late second callback fails above
+                reads.a_get ("/node.js-hedge-missing", function (rc) {
+                    assert.equal(++missing, 1);
+                    assert.equal(rc, ZK.ZNONODE);
+                    console.log ("TEST PASSED!", __filename);
+                    process.nextTick(function () {
+                        zk1.close ();
+                        zk2.close ();
+                    });
+                });
+            });
+        }
+    });
+});
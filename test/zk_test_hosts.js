@@ -0,0 +1,38 @@
+var assert = require('assert');
+var ZK = require ("../lib/zookeeper");
+
+var connect  = (process.argv[2] || 'localhost:2181');
+
+var zk = new ZK();
+var order = null;
+zk.on('host_order', function (o) {
+    order = o;
+});
+zk.connect({connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN,
+            host_policy: {order: 'rtt'}, reconnect_backoff: {base: 1000, max: 1000}}, function (err) {
+    if(err) throw err;
+    assert.ok(order, "no host_order event");
+    assert.ok(zk.server, "no connected server");
+    var dropped;
+    zk.once('connect', function () {
+        // the session survives a dropped connection, reconnecting no
+        // sooner than the backoff it drew
+        var elapsed = Date.now() - dropped;
+        var stats = zk.connection_stats;
+        console.log ("connection stats: %j, reconnected after %d ms", stats, elapsed);
+        assert.equal(stats.connects, 2);
+        assert.equal(stats.disconnects, 1);
+        assert.equal(stats.attempts, 2);    // the first connect and one reconnect
+        assert.ok(stats.last_backoff <= 1000);
+        assert.ok(elapsed >= stats.last_backoff - 10, "reconnected after " + elapsed + " ms, backoff was " + stats.last_backoff);
+        zk.a_exists ("/", false, function (rc, error, stat) {
+            assert.equal(rc, 0, error);
+            console.log ("TEST PASSED!", __filename);
+            process.nextTick(function () {
+                zk.close ();
+            });
+        });
+    });
+    dropped = Date.now();
+    assert.ok(zk.drop_connection());
+});
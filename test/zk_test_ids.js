@@ -0,0 +1,56 @@
+var assert = require('assert');
+var ZK = require ("../lib/zookeeper");
+
+var count = parseInt(process.argv[2] || 5000, 10);
+var connect  = (process.argv[3] || 'localhost:2181');
+
+var zk = new ZK();
+zk.connect({connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false}, function (err) {
+    if(err) throw err;
+    zk.a_create ("/node.js-ids", "", ZK.ZOO_SEQUENCE, function (rc, error, root) {
+        assert.equal(rc, 0, error);
+        // two allocators on one counter compete for blocks
+        var allocators = [zk.id_allocator(root + "/counter", { block: 100 }), zk.id_allocator(root + "/counter", { block: 100 })];
+        var seen = {}, done = 0;
+        allocators.forEach(function (ids) {
+            var n = 0, last = -1;
+            (function more() {
+                while(n < count) {
+                    var id = ids.take();
+                    if(id === null) {
+                        return ids.next(function (rc, error, id) {
+                            assert.equal(rc, 0, error);
+                            got(id);
+                            more();
+                        });
+                    }
+                    got(id);
+                }
+                if(++done === allocators.length) finish();
+            })();
+            function got(id) {
+                assert.ok(!seen[id], "duplicate id " + id);
+                assert.ok(id > last);
+                seen[id] = true;
+                last = id;
+                n++;
+            }
+        });
+        function finish() {
+            assert.equal(Object.keys(seen).length, 2 * count);
+            zk.a_get (root + "/counter", { encoding: 'utf8' }, function (rc, error, stat, data) {
+                assert.equal(rc, 0, error);
+                assert.ok(parseInt(data, 10) >= 2 * count);
+                zk.a_delete_ (root + "/counter", -1, function () {
+                    zk.a_delete_ (root, -1, function (rc, error) {
+                        assert.equal(rc, 0, error);
+                        console.log ("TEST PASSED!", __filename, JSON.stringify(allocators[0].stats));
+                        process.nextTick(function () {
+                            zk.close ();
+                        });
+                    });
+                });
+            });
+        }
+    });
+});
@@ -0,0 +1,68 @@
+var assert = require('assert');
+var ZK = require ("../lib/zookeeper");
+
+var connect  = (process.argv[2] || 'localhost:2181');
+var PATH = '/node.js-large';
+
+var zk = new ZK();
+
+// two writers start from the same manifest; the value read afterwards must
+// be complete and be one of the two
+function racingWriters(cb) {
+    var a = new Buffer(2 * 1024 * 1024), b = new Buffer(2 * 1024 * 1024);
+    a.fill(0x61);
+    b.fill(0x62);
+    var pending = 2, ok = 0;
+    [a, b].forEach(function (value) {
+        zk.a_set_large (PATH, value, function (rc, error) {
+            if(rc === 0) ok++;
+            if(--pending > 0) return;
+            assert.ok(ok >= 1, "both writers failed");
+            zk.a_get_large (PATH, function (rc, error, stat, data) {
+                assert.equal(rc, 0, error);
+                assert.ok(data.equals(a) || data.equals(b));
+                cb();
+            });
+        });
+    });
+}
+zk.connect({connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false}, function (err) {
+    if(err) throw err;
+    var value = new Buffer(3 * 1024 * 1024 + 17);
+    for (var i = 0; i < value.length; i++) {
+        value[i] = (i * 31) & 0xff;
+    }
+    zk.a_set_large (PATH, value, function (rc, error, stat) {
+        assert.equal(rc, 0, error);
+        zk.a_get_large (PATH, function (rc, error, stat, data) {
+            assert.equal(rc, 0, error);
+            assert.ok(Buffer.isBuffer(data));
+            assert.equal(data.length, value.length);
+            assert.equal(data.toString('hex'), value.toString('hex'));
+            // overwrite with a small value, which goes out in one transaction
+            zk.a_set_large (PATH, "small", function (rc, error, stat) {
+                assert.equal(rc, 0, error);
+                zk.a_get_large (PATH, function (rc, error, stat, data) {
+                    assert.equal(rc, 0, error);
+                    assert.equal(data.toString(), "small");
+                    racingWriters(function () {
+                        // a wrong version must leave the whole value in place
+                        zk.a_delete_large_ (PATH, 12345, function (rc, error) {
+                            assert.equal(rc, ZK.ZBADVERSION);
+                            zk.a_get_large (PATH, function (rc, error, stat, data) {
+                                assert.equal(rc, 0, error);
+                                zk.a_delete_large_ (PATH, -1, function (rc, error) {
+                                    assert.equal(rc, 0, error);
+                                    console.log ("TEST PASSED!", __filename);
+                                    process.nextTick(function () {
+                                        zk.close ();
+                                    });
+                                });
+                            });
+                        });
+                    });
+                });
+            });
+        });
+    });
+});
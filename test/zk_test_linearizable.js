@@ -0,0 +1,34 @@
+var assert = require('assert');
+var ZK = require ("../lib/zookeeper");
+
+var N = parseInt (process.argv[2] || 100);
+var connect  = (process.argv[3] || 'localhost:2181');
+
+var zk = new ZK();
+zk.connect({connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false}, function (err) {
+    if(err) throw err;
+    zk.a_create ("/node.js-linearizable", "v0", ZK.ZOO_SEQUENCE | ZK.ZOO_EPHEMERAL, function (rc, error, path) {
+        assert.equal(rc, 0, error);
+        zk.a_set (path, "v1", -1, function (rc, error, stat) {
+            assert.equal(rc, 0, error);
+            var counter = 0;
+            for (var i = 0; i < N; i ++) {
+                zk.a_get (path, {linearizable: true}, function (rc, error, stat, data) {
+                    assert.equal(rc, 0, error);
+                    assert.equal(data.toString(), "v1");
+                    if (++counter >= N) {
+                        var stats = zk.sync_stats;
+                        console.log ("sync stats: %j", stats);
+                        assert.equal(stats.reads, N);
+                        assert.equal(stats.saved, N - stats.syncs);
+                        assert.ok(stats.syncs < N, "syncs were not coalesced");
+                        console.log ("TEST PASSED!", __filename);
+                        process.nextTick(function () {
+                            zk.close ();
+                        });
+                    }
+                });
+            }
+        });
+    });
+});
@@ -0,0 +1,53 @@
+// expire a session that holds managed ephemerals, as in zk_test_end_session.js
+var ZK = require('../lib/zookeeper');
+var assert = require('assert');
+var connect  = (process.argv[2] || 'localhost:2181');
+var timeout = 5000;
+
+var zk = new ZK({connect: connect, timeout: timeout, debug_level: ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic: false});
+
+var expired = false;
+zk.on('close', function() { assert.fail('close', 'expired', 'a managed handle must not close'); });
+zk.on('expired', function(info) {
+  assert.equal(info.ephemerals, 2);
+  expired = true;
+});
+
+zk.connect(function (err) {
+  if(err) throw err;
+  var oldId = zk.client_id;
+  zk.register_ephemeral ('/node.js-managed-eph', 'a', function (rc, error, path) {
+    assert.equal(rc, 0, error);
+    zk.register_ephemeral ('/node.js-managed-seq-', 'b', {flags: ZK.ZOO_SEQUENCE}, function (rc, error, seqPath) {
+      assert.equal(rc, 0, error);
+      zk.on('ephemerals_restored', function (report) {
+        assert.ok(expired);
+        assert.equal(report.count, 2);
+        assert.equal(report.failed.length, 0);
+        assert.equal(report.renamed.length, 1);
+        assert.equal(report.renamed[0].from, seqPath);
+        assert.notEqual(zk.client_id, oldId);
+        zk.a_exists ('/node.js-managed-eph', false, function (rc, error, stat) {
+          assert.equal(rc, 0, error);
+          assert.ok(stat.createdInThisSession);
+          zk.unregister_ephemeral (report.renamed[0].to, function (rc, error) {
+            assert.equal(rc, 0, error);
+            zk.unregister_ephemeral ('/node.js-managed-eph', function (rc, error) {
+              assert.equal(rc, 0, error);
+              console.log ("TEST PASSED!", __filename);
+              zk.removeAllListeners('close');
+              zk.close();
+            });
+          });
+        });
+      });
+      // closing the session from a second handle expires it for the first
+      var zk2 = new ZK({connect: connect, timeout: timeout, debug_level: ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic: false,
+                 client_id: zk.client_id, client_password: zk.client_password});
+      zk2.connect(function (err) {
+        if(err) throw err;
+        zk2.close();
+      });
+    });
+  });
+});
@@ -0,0 +1,56 @@
+var assert = require('assert');
+var ZK = require ("../lib/zookeeper");
+
+var connect  = (process.argv[2] || 'localhost:2181');
+
+assert.throws(function () { ZK.path("no/slash"); });
+assert.throws(function () { ZK.path("/trailing//"); });
+assert.throws(function () { ZK.path("/a//b"); });
+assert.throws(function () { ZK.path("/a/../b"); });
+assert.equal(String(ZK.path("/")), "/");
+assert.equal(String(ZK.path("/queue/")), "/queue/");
+
+var zk = new ZK();
+zk.connect({connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false}, function (err) {
+    if(err) throw err;
+    zk.a_create ("/node.js-path", "", ZK.ZOO_SEQUENCE, function (rc, error, root) {
+        assert.equal(rc, 0, error);
+        var p = ZK.path(root + "/hot");
+        assert.equal(p.path, root + "/hot");
+        zk.a_multi ([{op: 'create', path: p, data: "v1", flags: 0}], function (rc, error) {
+            assert.equal(rc, 0, error);
+            zk.aw_get (p, function (type, state, path) {
+                assert.equal(type, ZK.ZOO_CHANGED_EVENT);
+                assert.equal(path, p.path);
+                zk.a_get (p, false, function (rc, error, stat, data) {
+                    assert.equal(rc, 0, error);
+                    assert.equal(data.toString(), "v2");
+                    zk.a_delete_ (p, -1, function (rc, error) {
+                        assert.equal(rc, 0, error);
+                        // a sequence create under a prefix ending in /
+                        zk.a_create (ZK.path(root + "/"), "", ZK.ZOO_SEQUENCE, function (rc, error, seq) {
+                            assert.equal(rc, 0, error);
+                            assert.ok(/\/\d{10}$/.test(seq), seq);
+                            zk.a_delete_ (seq, -1, function (rc, error) {
+                                assert.equal(rc, 0, error);
+                                zk.a_delete_ (root, -1, function (rc, error) {
+                                    assert.equal(rc, 0, error);
+                                    console.log ("TEST PASSED!", __filename);
+                                    process.nextTick(function () {
+                                        zk.close ();
+                                    });
+                                });
+                            });
+                        });
+                    });
+                });
+            }, function (rc, error, stat, data) {
+                assert.equal(rc, 0, error);
+                assert.equal(data.toString(), "v1");
+                zk.a_set (p, "v2", -1, function (rc, error) {
+                    assert.equal(rc, 0, error);
+                });
+            });
+        });
+    });
+});
@@ -0,0 +1,114 @@
+var assert = require('assert');
+var net = require('net');
+var ZK = require ("../lib/zookeeper");
+var HostPolicy = require ("../lib/zk_hosts");
+
+// Stand-in servers answering four-letter words; the connect string
+// argument is not needed.
+
+var MNTR = [
+    "zk_version\t3.4.9-1757313, built on 08/23/2016 06:50 GMT",
+    "zk_avg_latency\t%AVG%",
+    "zk_max_latency\t48",
+    "zk_min_latency\t0",
+    "zk_packets_received\t1200",
+    "zk_packets_sent\t1199",
+    "zk_num_alive_connections\t7",
+    "zk_outstanding_requests\t%OUT%",
+    "zk_server_state\tfollower",
+    "zk_znode_count\t312",
+    "zk_watch_count\t45",
+    "zk_ephemerals_count\t3",
+    "zk_approximate_data_size\t20480",
+    ""
+].join("\n");
+
+var STAT = [
+    "Zookeeper version: 3.4.9-1757313, built on 08/23/2016 06:50 GMT",
+    "Clients:",
+    " /127.0.0.1:50224[0](queued=0,recved=1,sent=0)",
+    "",
+    "Latency min/avg/max: 0/%AVG%/48",
+    "Received: 1200",
+    "Sent: 1199",
+    "Connections: 7",
+    "Outstanding: %OUT%",
+    "Zxid: 0x10000002a",
+    "Mode: follower",
+    "Node count: 312",
+    ""
+].join("\n");
+
+var WCHS = "7 connections watching 12 paths\nTotal watches:45\n";
+
+function standIn(outstanding, avg, mntr, cb) {
+    var server = net.createServer(function (socket) {
+        var cmd = "";
+        socket.on('data', function (d) {
+            cmd += d.toString();
+            if(cmd.length < 4) return;
+            var out;
+            if(cmd === "mntr") {
+                out = mntr ? MNTR : "mntr is not executed because it is not in the whitelist.\n";
+            } else if(cmd === "stat") {
+                out = STAT;
+            } else if(cmd === "wchs") {
+                out = WCHS;
+            } else {
+                out = "";
+            }
+            socket.end(out.replace(/%OUT%/g, outstanding).replace(/%AVG%/g, avg));
+        });
+    });
+    server.listen(0, '127.0.0.1', function () {
+        cb(server, '127.0.0.1:' + server.address().port);
+    });
+}
+
+standIn(25, 9, true, function (busy, busyHost) {
+    standIn(0, 1, false, function (idle, idleHost) {
+        // a port nobody listens on
+        var closed = net.createServer().listen(0, '127.0.0.1', function () {
+            var deadHost = '127.0.0.1:' + closed.address().port;
+            closed.close(function () {
+                var connect = [busyHost, idleHost, deadHost].join(',') + '/chroot';
+                ZK.probe(connect, { timeout: 500 }, function (err, results) {
+                    assert.ifError(err);
+                    var b = results[busyHost], i = results[idleHost], d = results[deadHost];
+                    assert.ok(b.ok && i.ok && !d.ok);
+                    assert.ok(d.error);
+                    assert.equal(b.mntr.outstanding_requests, 25);
+                    assert.equal(b.mntr.server_state, 'follower');
+                    assert.equal(b.outstanding, 25);
+                    assert.equal(b.latency_avg, 9);
+                    assert.equal(b.znodes, 312);
+                    assert.equal(b.watches, 45);
+                    assert.equal(b.stat.zxid, 0x10000002a);
+                    assert.deepEqual(b.wchs, { connections: 7, paths: 12, watches: 45 });
+                    // mntr refused: the summary comes from stat and wchs
+                    assert.strictEqual(i.mntr, null);
+                    assert.equal(i.outstanding, 0);
+                    assert.equal(i.latency_max, 48);
+                    assert.equal(i.mode, 'follower');
+                    assert.equal(i.watches, 45);
+
+                    var fakeZk = { emit: function () {} };
+                    new HostPolicy(fakeZk, { order: 'load', probe_timeout: 500 }).order(connect, function (ordered) {
+                        assert.equal(ordered, [idleHost, busyHost, deadHost].join(',') + '/chroot');
+
+                        var rounds = 0;
+                        var prober = new ZK.Prober(connect, { interval: 50, timeout: 500, commands: ['stat'] });
+                        prober.on('probe', function (results) {
+                            assert.equal(results[busyHost].outstanding, 25);
+                            if(++rounds < 2) return;
+                            prober.stop();
+                            busy.close();
+                            idle.close();
+                            console.log ("TEST PASSED!", __filename);
+                        });
+                    });
+                });
+            });
+        });
+    });
+});
@@ -0,0 +1,87 @@
+var assert = require('assert');
+var spawn = require('child_process').spawn;
+var ZK = require ("../lib/zookeeper");
+var HostPolicy = require ("../lib/zk_hosts");
+
+var connect  = (process.argv[2] || 'localhost:2181');
+
+// The bundled 3.4 client has no read-only mode: init({ readonly: true })
+// logs a warning to the client log (stderr) and opens a regular session,
+// which reports ZOO_CONNECTED_STATE and 'connect', never 'readonly'.
+if (process.argv[3] === 'fallback') {
+    var child = new ZK();
+    child.on('readonly', function () {
+        assert.fail("a 3.4 session cannot be read-only");
+    });
+    child.connect({connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false, readonly:true}, function (err) {
+        if(err) throw err;
+        assert.equal(child.state, ZK.ZOO_CONNECTED_STATE);
+        child.close ();
+    });
+    return;
+}
+
+// observers go first in the host order, and only they are preferred
+var members = ['127.0.0.1:2181', '127.0.0.2:2181', '127.0.0.3:2181'];
+var observers = ['127.0.0.4:2181', '127.0.0.5:2181'];
+var fakeZk = { server: null, emit: function (ev, info) { this[ev] = info; } };
+var policy = new HostPolicy(fakeZk, { observers: observers });
+policy.order(members.concat(observers).join(',') + '/chroot', function (ordered) {
+    var chroot = ordered.substring(ordered.indexOf('/'));
+    var hosts = ordered.substring(0, ordered.indexOf('/')).split(',');
+    assert.equal(chroot, '/chroot');
+    assert.deepEqual(hosts.slice(0, 2).sort(), observers);
+    assert.deepEqual(hosts.slice(2).sort(), members);
+    assert.deepEqual(fakeZk.host_order.preferred.sort(), observers);
+    fakeZk.server = members[0];
+    assert.ok(!policy.isPreferred());
+    fakeZk.server = observers[1];
+    assert.ok(policy.isPreferred());
+
+    var stderr = "";
+    var fallback = spawn(process.execPath, [__filename, connect, 'fallback'], { stdio: ['ignore', 'inherit', 'pipe'] });
+    fallback.stderr.on('data', function (d) { stderr += d; });
+    fallback.on('close', function (code) {
+        assert.equal(code, 0, stderr);
+        assert.ok(/read-only sessions need a 3.5 or later client/.test(stderr), stderr);
+        refusal();
+    });
+});
+
+// Writes on a read-only session fail locally. The 3.4 client cannot reach
+// ZOO_READONLY_STATE, so the state is forced here: this covers the JS
+// refusal only, not a server-reported read-only session.
+function refusal() {
+    var zk = new ZK();
+    zk.connect({connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false, readonly:true}, function (err) {
+        if(err) throw err;
+        var state = zk.__lookupGetter__('state');
+        zk.__defineGetter__('state', function () { return ZK.ZOO_READONLY_STATE; });
+        var sync = true;
+        var rc = zk.a_create ("/node.js-readonly", "x", ZK.ZOO_SEQUENCE, function (rc, error) {
+            assert.ok(!sync, "refused synchronously");
+            assert.equal(rc, ZK.ZNOTREADONLY);
+            assert.ok(/read-only/.test(error), error);
+            zk.a_set ("/", "x", -1, function (rc) {
+                assert.equal(rc, ZK.ZNOTREADONLY);
+                zk.a_multi ([{op: 'delete', path: "/node.js-readonly", version: -1}], function (rc) {
+                    assert.equal(rc, ZK.ZNOTREADONLY);
+                    // reads still go to the server
+                    zk.a_exists ("/", false, function (rc, error) {
+                        assert.equal(rc, 0, error);
+                        zk.__defineGetter__('state', state);
+                        zk.a_create ("/node.js-readonly", "x", ZK.ZOO_SEQUENCE | ZK.ZOO_EPHEMERAL, function (rc, error) {
+                            assert.equal(rc, 0, error);
+                            console.log ("TEST PASSED!", __filename);
+                            process.nextTick(function () {
+                                zk.close ();
+                            });
+                        });
+                    });
+                });
+            });
+        });
+        sync = false;
+        assert.equal(rc, ZK.ZOK);
+    });
+}
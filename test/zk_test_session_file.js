@@ -0,0 +1,61 @@
+var assert = require('assert');
+var os = require('os');
+var fs = require('fs');
+var ZK = require ("../lib/zookeeper");
+
+var connect  = (process.argv[2] || 'localhost:2181');
+var file = os.tmpdir() + "/zk_test_session_file." + process.pid + ".json";
+
+function options(session_file) {
+    return {connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false, session_file:session_file};
+}
+
+// a watch set before the handle is closed fires after a resume from the
+// session file, when the znode changed in between
+var zk = new ZK();
+zk.connect(options(file), function (err) {
+    if(err) throw err;
+    zk.a_create ("/node.js-session", "1", ZK.ZOO_SEQUENCE, function (rc, error, path) {
+        assert.equal(rc, 0, error);
+        zk.a_get (path, true, function (rc, error) {
+            assert.equal(rc, 0, error);
+            zk.close ();
+            assert.equal(fs.statSync(file).mode & parseInt('777', 8), parseInt('600', 8));
+            var saved = JSON.parse(fs.readFileSync(file, 'utf8'));
+            assert.ok(saved.watches[path], "watch not saved");
+            // close() ended the session: only the watches are kept
+            assert.strictEqual(saved.client_id, undefined);
+
+            // changed while nobody watches
+            var writer = new ZK();
+            writer.connect(options(null), function (err) {
+                if(err) throw err;
+                writer.a_set (path, "2", -1, function (rc, error) {
+                    assert.equal(rc, 0, error);
+                    writer.close ();
+
+                    var resumed = new ZK(), changed = false;
+                    resumed.on('changed', function (zk, p) {
+                        if(p === path) changed = true;
+                    });
+                    resumed.on('restored', function (info) {
+                        assert.ok(changed, "no changed event for " + path);
+                        assert.equal(info.watches, 1);
+                        assert.equal(info.changed, 1);
+                        resumed.a_delete_ (path, -1, function (rc, error) {
+                            assert.equal(rc, 0, error);
+                            console.log ("TEST PASSED!", __filename);
+                            process.nextTick(function () {
+                                resumed.close ();
+                                fs.unlinkSync(file);
+                            });
+                        });
+                    });
+                    resumed.connect(options(file), function (err) {
+                        if(err) throw err;
+                    });
+                });
+            });
+        });
+    });
+});
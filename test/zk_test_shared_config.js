@@ -0,0 +1,73 @@
+var assert = require('assert');
+var os = require('os');
+var fs = require('fs');
+var ZK = require ("../lib/zookeeper");
+
+var connect  = (process.argv[2] || 'localhost:2181');
+var file = os.tmpdir() + "/zk_test_shared_config." + process.pid;
+
+var zk = new ZK();
+zk.connect({connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false}, function (err) {
+    if(err) throw err;
+    zk.a_create ("/node.js-shared", "root", ZK.ZOO_SEQUENCE, function (rc, error, root) {
+        assert.equal(rc, 0, error);
+        zk.a_multi ([
+            {op: 'create', path: root + "/a", data: "1", flags: 0},
+            {op: 'create', path: root + "/b", data: "", flags: 0},
+            {op: 'create', path: root + "/b/c", data: "deep", flags: 0}
+        ], function (rc, error) {
+            assert.equal(rc, 0, error);
+            var config = null, step = 0, lastGeneration = 0;
+            var pub = zk.publish_config(root, file);
+            pub.on('error', function (e) { throw e; });
+            pub.on('publish', function (info) {
+                assert.ok(info.generation > lastGeneration);
+                lastGeneration = info.generation;
+                if(!config) config = ZK.open_shared_config(file);
+                assert.equal(config.generation, info.generation);
+                var a = config.get(root + "/a");
+                if(step === 0 && info.nodes === 4) {
+                    step = 1;
+                    assert.equal(a.toString(), "1");
+                    assert.equal(config.get(root + "/b/c").toString(), "deep");
+                    assert.equal(config.get(root).toString(), "root");
+                    assert.strictEqual(config.get(root + "/missing"), null);
+                    zk.a_set (root + "/a", "2", -1, function (rc, error) {
+                        assert.equal(rc, 0, error);
+                        zk.a_create (root + "/b/d", "new", 0, function (rc, error) {
+                            assert.equal(rc, 0, error);
+                        });
+                    });
+                } else if(step === 1 && a.toString() === "2" && config.get(root + "/b/d")) {
+                    step = 2;
+                    assert.equal(config.get(root + "/b/d").toString(), "new");
+                    zk.a_delete_ (root + "/b/c", -1, function (rc, error) {
+                        assert.equal(rc, 0, error);
+                    });
+                } else if(step === 2 && !config.get(root + "/b/c")) {
+                    step = 3;
+                    assert.equal(info.nodes, 4);
+                    // one publisher per file
+                    assert.throws(function () { zk.publish_config(root, file); }, /publisher already/);
+                    pub.close();
+                    new ZK.SharedConfig(file, true).close();
+                    config.close();
+                    fs.unlinkSync(file);
+                    zk.a_delete_ (root + "/b/d", -1, function () {
+                        zk.a_delete_ (root + "/b", -1, function () {
+                            zk.a_delete_ (root + "/a", -1, function () {
+                                zk.a_delete_ (root, -1, function (rc, error) {
+                                    assert.equal(rc, 0, error);
+                                    console.log ("TEST PASSED!", __filename);
+                                    process.nextTick(function () {
+                                        zk.close ();
+                                    });
+                                });
+                            });
+                        });
+                    });
+                }
+            });
+        });
+    });
+});
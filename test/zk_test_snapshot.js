@@ -0,0 +1,100 @@
+var assert = require('assert');
+var fs = require('fs');
+var ZK = require ("../lib/zookeeper");
+
+var N = parseInt (process.argv[2] || 200);
+var connect  = (process.argv[3] || 'localhost:2181');
+var file = '/tmp/node.js-snapshot-' + process.pid;
+
+var zk = new ZK();
+zk.connect({connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false}, function (err) {
+    if(err) throw err;
+    zk.a_create ("/node.js-snapshot", "", ZK.ZOO_SEQUENCE, function (rc, error, root) {
+        assert.equal(rc, 0, error);
+        var w = new ZK.SnapshotWriter(file);
+        var readOnly = w.acl([ZK.ZOO_READ_ACL_UNSAFE]);
+        w.node(root + "/a", "parent", 0);
+        for (var i = 0; i < N; i++) {
+            w.node(root + "/a/n" + i, "v" + i, 0);
+        }
+        w.node(root + "/ro", "locked", 0, readOnly);
+        w.node(root + "/eph", "skipped", ZK.ZOO_EPHEMERAL);
+        w.end();
+
+        var progress = 0;
+        // small batches so that several are in flight at once
+        zk.import_snapshot (file, {batch_ops: 16, in_flight: 3}, function (err, summary) {
+            assert.ifError(err);
+            assert.equal(summary.nodes, N + 2);
+            assert.equal(summary.skipped, 1);
+            assert.ok(progress > 1);
+            zk.a_get (root + "/a/n7", false, function (rc, error, stat, data) {
+                assert.equal(rc, 0, error);
+                assert.equal(data, "v7");
+                zk.a_get_acl (root + "/ro", function (rc, error, acl) {
+                    assert.equal(rc, 0, error);
+                    assert.equal(acl[0].perms, ZK.ZOO_PERM_READ);
+                    zk.a_exists (root + "/eph", false, function (rc) {
+                        assert.equal(rc, ZK.ZNONODE);
+                        // a second import finds everything in place
+                        zk.import_snapshot (file, {batch_ops: 16}, function (err, summary) {
+                            assert.ifError(err);
+                            assert.equal(summary.nodes, N + 2);
+                            overlap(root);
+                        });
+                    });
+                });
+            });
+        }).on('progress', function () {
+            progress++;
+        });
+    });
+});
+
+// Batch 1 overlaps an existing node and fails as a whole; batch 2 holds
+// the children of its new node and is already in flight behind it.
+function overlap(root) {
+    var w = new ZK.SnapshotWriter(file);
+    w.node(root + "/s/pre", "", 0);
+    w.node(root + "/s/new", "", 0);
+    w.node(root + "/s/new/c0", "", 0);
+    w.node(root + "/s/new/c1", "", 0);
+    w.node(root + "/s/new/c2", "", 0);
+    w.end();
+    zk.a_multi ([
+        {op: 'create', path: root + "/s", data: "", flags: 0},
+        {op: 'create', path: root + "/s/pre", data: "", flags: 0}
+    ], function (rc, error) {
+        assert.equal(rc, 0, error);
+        zk.import_snapshot (file, {batch_ops: 2, in_flight: 3}, function (err, summary) {
+            assert.ifError(err);
+            assert.equal(summary.nodes, 5);
+            zk.a_get_children (root + "/s/new", false, function (rc, error, children) {
+                assert.equal(rc, 0, error);
+                assert.deepEqual(children.sort(), ["c0", "c1", "c2"]);
+                cleanup(root);
+            });
+        });
+    });
+}
+
+function cleanup(root) {
+    var ops = [];
+    ["/s/new/c0", "/s/new/c1", "/s/new/c2", "/s/new", "/s/pre", "/s"].forEach(function (p) {
+        ops.push({op: 'delete', path: root + p});
+    });
+    for (var i = 0; i < N; i++) {
+        ops.push({op: 'delete', path: root + "/a/n" + i});
+    }
+    ops.push({op: 'delete', path: root + "/a"});
+    ops.push({op: 'delete', path: root + "/ro"});
+    ops.push({op: 'delete', path: root});
+    zk.a_multi (ops, function (rc, error) {
+        assert.equal(rc, 0, error);
+        fs.unlinkSync(file);
+        console.log ("TEST PASSED!", __filename);
+        process.nextTick(function () {
+            zk.close ();
+        });
+    });
+}
@@ -0,0 +1,97 @@
+var assert = require('assert');
+var ZK = require ("../lib/zookeeper");
+
+var N = parseInt (process.argv[2] || 50);
+var connect  = (process.argv[3] || 'localhost:2181');
+
+var zk = new ZK();
+zk.connect({connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false}, function (err) {
+    if(err) throw err;
+    zk.a_create ("/node.js-walk", "root", ZK.ZOO_SEQUENCE, function (rc, error, root) {
+        assert.equal(rc, 0, error);
+        var ops = [];
+        for (var i = 0; i < N; i++) {
+            ops.push({op: 'create', path: root + "/c" + i, data: "v" + i, flags: 0});
+            ops.push({op: 'create', path: root + "/c" + i + "/g", data: "", flags: 0});
+        }
+        zk.a_multi (ops, function (rc, error) {
+            assert.equal(rc, 0, error);
+            var seen = {}, count = 0;
+            // a small buffer forces the walker through pause/resume
+            zk.walk (root, {window: 8, highWaterMark: 4}).on('data', function (rec) {
+                count++;
+                seen[rec.path] = rec.data.toString();
+            }).on('error', function (err) {
+                throw err;
+            }).on('end', function () {
+                assert.equal(count, 1 + 2 * N);
+                assert.equal(seen[root], "root");
+                assert.equal(seen[root + "/c7"], "v7");
+                var shallow = 0;
+                zk.walk (root, {depth: 1, data: false}).on('data', function (rec) {
+                    assert.equal(rec.data, null);
+                    shallow++;
+                }).on('end', function () {
+                    assert.equal(shallow, 1 + N);
+                    cleanup(root);
+                });
+            });
+        });
+    });
+});
+
+function cleanup(root) {
+    var ops = [];
+    for (var i = 0; i < N; i++) {
+        ops.push({op: 'delete', path: root + "/c" + i + "/g"});
+        ops.push({op: 'delete', path: root + "/c" + i});
+    }
+    ops.push({op: 'delete', path: root});
+    zk.a_multi (ops, function (rc, error) {
+        assert.equal(rc, 0, error);
+        longPaths();
+    });
+}
+
+// child paths longer than ZOOKEEPER_MAX_PATH_LENGTH are walked whole
+function longPaths() {
+    var name = new Array(701).join("x");
+    zk.a_create ("/node.js-walk-long", "", ZK.ZOO_SEQUENCE, function (rc, error, root) {
+        assert.equal(rc, 0, error);
+        var deep = root + "/" + name + "/" + name;
+        zk.a_multi ([
+            {op: 'create', path: root + "/" + name, data: "", flags: 0},
+            {op: 'create', path: deep, data: "deep", flags: 0}
+        ], function (rc, error) {
+            assert.equal(rc, 0, error);
+            var seen = {};
+            zk.walk (root).on('data', function (rec) {
+                seen[rec.path] = String(rec.data);
+            }).on('end', function () {
+                assert.equal(seen[deep], "deep");
+                zk.a_multi ([
+                    {op: 'delete', path: deep},
+                    {op: 'delete', path: root + "/" + name},
+                    {op: 'delete', path: root}
+                ], function (rc, error) {
+                    assert.equal(rc, 0, error);
+                    closeOnError();
+                });
+            });
+        });
+    });
+}
+
+// a walk the client refuses ends synchronously; closing the handle from
+// the error handler must not free the walk under the walker
+function closeOnError() {
+    zk.walk ("node.js-no-slash").on('error', function (err) {
+        assert.equal(err.rc, ZK.ZBADARGUMENTS);
+        zk.close ();
+        setTimeout(function () {
+            console.log ("TEST PASSED!", __filename);
+        }, 10);
+    }).on('data', function () {
+        assert.fail("no records expected");
+    }).resume();
+}
@@ -0,0 +1,63 @@
+var assert = require('assert');
+var ZK = require ("../lib/zookeeper");
+
+var connect  = (process.argv[2] || 'localhost:2181');
+
+var zk = new ZK();
+zk.connect({connect:connect, timeout:5000, debug_level:ZK.ZOO_LOG_LEVEL_WARN, host_order_deterministic:false}, function (err) {
+    if(err) throw err;
+    zk.a_create ("/node.js-watch-children", "", ZK.ZOO_SEQUENCE, function (rc, error, parent) {
+        assert.equal(rc, 0, error);
+        zk.a_create (parent + "/b", "", ZK.ZOO_EPHEMERAL, function (rc, error) {
+            assert.equal(rc, 0, error);
+            var step = 0;
+            zk.watch_children (parent, function onDiff (rc, error, added, removed, full) {
+                step++;
+                if (step === 1) {
+                    assert.equal(rc, 0, error);
+                    assert.ok(full);
+                    assert.deepEqual(added, ["b"]);
+                    zk.a_create (parent + "/a", "", ZK.ZOO_EPHEMERAL, function (rc, error) {
+                        assert.equal(rc, 0, error);
+                    });
+                } else if (step === 2) {
+                    assert.ok(!full);
+                    assert.deepEqual(added, ["a"]);
+                    assert.deepEqual(removed, []);
+                    zk.a_delete_ (parent + "/b", -1, function (rc, error) {
+                        assert.equal(rc, 0, error);
+                    });
+                } else if (step === 3) {
+                    assert.deepEqual(added, []);
+                    assert.deepEqual(removed, ["b"]);
+                    assert.ok(zk.unwatch_children (parent, onDiff));
+                    zk.a_delete_ (parent + "/a", -1, function (rc, error) {
+                        assert.equal(rc, 0, error);
+                        zk.a_delete_ (parent, -1, function (rc, error) {
+                            assert.equal(rc, 0, error);
+                            // unsubscribing from inside the ZNONODE callback
+                            // must release the subscription exactly once
+                            var calls = 0;
+                            zk.watch_children (parent, function onGone (rc, error, added, removed) {
+                                calls++;
+                                assert.equal(rc, ZK.ZNONODE);
+                                assert.equal(calls, 1);
+                                assert.ok(zk.unwatch_children (parent, onGone));
+                                zk.a_exists (parent, false, function (rc) {
+                                    assert.equal(rc, ZK.ZNONODE);
+                                    assert.ok(!zk.unwatch_children (parent, onGone));
+                                    console.log ("TEST PASSED!", __filename);
+                                    process.nextTick(function () {
+                                        zk.close ();
+                                    });
+                                });
+                            });
+                        });
+                    });
+                } else {
+                    assert.fail("called after unwatch_children");
+                }
+            });
+        });
+    });
+});